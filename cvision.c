@@ -9,8 +9,16 @@
  */
 
 #define _CRT_SECURE_NO_WARNINGS
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
 
 #include "cvision.h"
+
+#ifdef __linux__
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#endif
 //+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 // EDGE DETECTION
 //+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
@@ -23,29 +31,263 @@
 */
 int vc_gray_edge_sobel(IVC *src, IVC *dst, float th)
 {
-	// Local variavles
-	unsigned char *datasrc = (unsigned char *)src->data;
-	unsigned char *datadst = (unsigned char *)dst->data;
-	int channels = src->channels;
-	int width = src->width;
-	int height = src->height;
-	int bytesperline = src->bytesperline;
-	int x, y, i, posA, posB, posC, posD, posX, posE, posF, posG, posH, sumx, sumy, histmax, histthreshold;
-	int hist[GRAYLEVELS] = {0};
+	int nlevels = VC_HISTLEVELS(dst->levels);
+	long long *hist;
+	int ok;
 
-	// Error check
-	if ((src->width <= MINWIDTH) || (src->height <= MINHEIGHT))
+	// Apply the operators in x and y axis (gradient), and calculate the magnitude of the vector
+	if (!vc_gray_gradient_sobel(src, dst))
 		return 0;
-	if ((dst->width <= MINWIDTH) || (dst->height <= MINHEIGHT))
+
+	// Compute a grey level histogram, find the threshold and apply it
+	hist = (long long *)calloc(nlevels, sizeof(long long));
+	if (!hist)
 		return 0;
-	if ((src->channels != VC_CH_1) || (dst->channels != VC_CH_1))
+
+	vc_gray_histogram(dst, 1, dst->height, hist);
+	ok = vc_gray_binarize(dst, 1, dst->height, vc_histogram_threshold(hist, nlevels, (long long)dst->width * dst->height, th));
+
+	free(hist);
+
+	return ok;
+}
+
+/**
+ * @summary: Prewitt edge detection
+ * @src: Receives the source image pointer
+ * @dst: Receives the destination image pointer
+ * @th: receives the edging threshold [0.001, 1.00]
+ * @return: true if the operation succeeds, false if not
+*/
+int vc_gray_edge_prewitt(IVC *src, IVC *dst, float th)
+{
+	int nlevels = VC_HISTLEVELS(dst->levels);
+	long long *hist;
+	int ok;
+
+	// Apply the operators in x and y axis (gradient), and calculate the magnitude of the vector
+	if (!vc_gray_gradient_prewitt(src, dst))
+		return 0;
+
+	// Compute a grey level histogram, find the threshold and apply it
+	hist = (long long *)calloc(nlevels, sizeof(long long));
+	if (!hist)
+		return 0;
+
+	vc_gray_histogram(dst, 1, dst->height, hist);
+	ok = vc_gray_binarize(dst, 1, dst->height, vc_histogram_threshold(hist, nlevels, (long long)dst->width * dst->height, th));
+
+	free(hist);
+
+	return ok;
+}
+
+/**
+ * @summary: Sobel (weight 2) or Prewitt (weight 1) gradient magnitude of a 16-bit gray image,
+ * with int32 accumulators. The magnitude saturates at dst->levels
+ * @src: Receives the source image pointer
+ * @dst: Receives the destination image pointer
+ * @weight: Receives the weight of the center row/column of the operator
+ * @ystart: Receives the first row, at least 1
+ * @yend: Receives the row after the last one, at most height - 1
+ * @return: true if the operation succeeds, false if not
+*/
+static int vc_gray16_gradient(IVC *src, IVC *dst, int weight, int ystart, int yend)
+{
+	int width = src->width;
+	long long samplesperline = src->bytesperline / 2;
+	int levels = dst->levels;
+	int div = weight + 2;
+	unsigned short *datasrc, *above, *below, *datadst;
+	int x, y, sumx, sumy;
+	double magnitude;
+
+	for (y = ystart; y < yend; y++)
+	{
+		datasrc = (unsigned short *)src->data + y * samplesperline;
+		above = datasrc - samplesperline;
+		below = datasrc + samplesperline;
+		datadst = (unsigned short *)dst->data + y * samplesperline;
+
+		for (x = 1; x < width - 1; x++)
+		{
+			// Derivative of xx axis
+			sumx = (above[x + 1] - above[x - 1]) + weight * (datasrc[x + 1] - datasrc[x - 1]) + (below[x + 1] - below[x - 1]);
+			sumx /= div;
+
+			// Derivative of yy axis
+			sumy = (below[x - 1] - above[x - 1]) + weight * (below[x] - above[x]) + (below[x + 1] - above[x + 1]);
+			sumy /= div;
+
+			// Calculate the magnitude of the vector
+			magnitude = sqrt((double)sumx * sumx + (double)sumy * sumy);
+			datadst[x] = (unsigned short)MIN(magnitude, levels);
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * @summary: Sobel (weight 2) or Prewitt (weight 1) gradient magnitude of a 8-bit gray image with
+ * row pointers instead of per pixel offsets. Same results as the vc_gray_gradient_sobel and
+ * vc_gray_gradient_prewitt kernels
+ * @src: Receives the source image pointer
+ * @dst: Receives the destination image pointer
+ * @weight: Receives the weight of the center row/column of the operator
+ * @ystart: Receives the first row, at least 1
+ * @yend: Receives the row after the last one, at most height - 1
+*/
+static void vc_gray8_gradient(IVC *src, IVC *dst, int weight, int ystart, int yend)
+{
+	int width = src->width;
+	long long bytesperline = src->bytesperline;
+	int div = weight + 2;
+	unsigned char *datasrc, *above, *below, *datadst;
+	int x, y, sumx, sumy;
+
+	for (y = ystart; y < yend; y++)
+	{
+		datasrc = src->data + y * bytesperline;
+		above = datasrc - bytesperline;
+		below = datasrc + bytesperline;
+		datadst = dst->data + y * bytesperline;
+
+		for (x = 1; x < width - 1; x++)
+		{
+			// Derivative of xx axis
+			sumx = (above[x + 1] - above[x - 1]) + weight * (datasrc[x + 1] - datasrc[x - 1]) + (below[x + 1] - below[x - 1]);
+			sumx /= div;
+
+			// Derivative of yy axis
+			sumy = (below[x - 1] - above[x - 1]) + weight * (below[x] - above[x]) + (below[x + 1] - above[x + 1]);
+			sumy /= div;
+
+			// Calculate the magnitude of the vector
+			datadst[x] = (unsigned char)MIN(sqrt((double)(sumx * sumx + sumy * sumy)), SIZEOFUCHAR);
+		}
+	}
+}
+
+/**
+ * @summary: Sobel (weight 2) or Prewitt (weight 1) gradient magnitude of a 8-bit or 16-bit gray image
+ * with shared column sums. Both derivatives are separable, gx is the difference of the weighted column
+ * sums a + w * b + c at x + 1 and x - 1, and gy the weighted row sum of the column differences c - a
+ * at x - 1, x, x + 1. A first loop computes the sum and difference of each column once (3 sample
+ * loads per pixel instead of 8), a second one combines them. No value is carried from one pixel to
+ * the next, so both loops vectorize. Same results as the other kernels
+ * @src: Receives the source image pointer
+ * @dst: Receives the destination image pointer
+ * @weight: Receives the weight of the center row/column of the operator
+ * @ystart: Receives the first row, at least 1
+ * @yend: Receives the row after the last one, at most height - 1
+ * @return: true if the operation succeeds, false if not
+*/
+static int vc_gray_runsum_gradient(IVC *src, IVC *dst, int weight, int ystart, int yend)
+{
+	int width = src->width;
+	long long bytesperline = src->bytesperline;
+	long long samplesperline = src->bytesperline / 2;
+	int maximum = MAX(dst->levels, SIZEOFUCHAR);
+	unsigned char *datasrc, *above, *below, *datadst;
+	unsigned short *datasrc16, *above16, *below16, *datadst16;
+	int *sum, *diff, *mag;
+	int x, y, sumx, sumy;
+
+	if (width < 3)
+		return 1;
+
+	sum = (int *)malloc(width * sizeof(int));
+	diff = (int *)malloc(width * sizeof(int));
+	mag = (int *)malloc(width * sizeof(int));
+	if (!sum || !diff || !mag)
+	{
+		free(sum);
+		free(diff);
+		free(mag);
 		return 0;
+	}
+
+	for (y = ystart; y < yend; y++)
+	{
+		datasrc = src->data + y * bytesperline;
+		datasrc16 = (unsigned short *)src->data + y * samplesperline;
+
+		// Weighted sum and difference of every column
+		if (src->levels > SIZEOFUCHAR)
+		{
+			above16 = datasrc16 - samplesperline;
+			below16 = datasrc16 + samplesperline;
+			for (x = 0; x < width; x++)
+			{
+				sum[x] = above16[x] + weight * datasrc16[x] + below16[x];
+				diff[x] = below16[x] - above16[x];
+			}
+		}
+		else
+		{
+			above = datasrc - bytesperline;
+			below = datasrc + bytesperline;
+			for (x = 0; x < width; x++)
+			{
+				sum[x] = above[x] + weight * datasrc[x] + below[x];
+				diff[x] = below[x] - above[x];
+			}
+		}
+
+		// Combine the neighbour columns, one loop per operator so that the division is by a constant
+		if (weight == 2)
+			for (x = 1; x < width - 1; x++)
+			{
+				sumx = (sum[x + 1] - sum[x - 1]) / 4;
+				sumy = (diff[x - 1] + 2 * diff[x] + diff[x + 1]) / 4;
+				mag[x] = (int)MIN(sqrt((double)sumx * sumx + (double)sumy * sumy), maximum);
+			}
+		else
+			for (x = 1; x < width - 1; x++)
+			{
+				sumx = (sum[x + 1] - sum[x - 1]) / 3;
+				sumy = (diff[x - 1] + diff[x] + diff[x + 1]) / 3;
+				mag[x] = (int)MIN(sqrt((double)sumx * sumx + (double)sumy * sumy), maximum);
+			}
+
+		// Store the magnitude
+		if (dst->levels > SIZEOFUCHAR)
+		{
+			datadst16 = (unsigned short *)dst->data + y * samplesperline;
+			for (x = 1; x < width - 1; x++)
+				datadst16[x] = (unsigned short)mag[x];
+		}
+		else
+		{
+			datadst = dst->data + y * bytesperline;
+			for (x = 1; x < width - 1; x++)
+				datadst[x] = (unsigned char)mag[x];
+		}
+	}
+
+	free(sum);
+	free(diff);
+	free(mag);
+
+	return 1;
+}
 
-	// Get the number of pixels of the image w*h
-	int size = width * height;
+/**
+ * @summary: Sobel gradient magnitude of the rows [ystart, yend), 1 <= ystart, yend <= height - 1
+*/
+static void vc_gray_sobel_rows(IVC *src, IVC *dst, int ystart, int yend)
+{
+	// Local variavles
+	unsigned char *datasrc = (unsigned char *)src->data;
+	unsigned char *datadst = (unsigned char *)dst->data;
+	int width = src->width;
+	long long bytesperline = src->bytesperline;
+	long long posA, posB, posC, posD, posX, posE, posF, posG, posH;
+	int x, y, sumx, sumy;
 
 	// Apply the operators in x and y axis (gradient), and calculate the magnitude of the vector
-	for (y = 1; y < height - 1; y++)
+	for (y = ystart; y < yend; y++)
 	{
 		for (x = 1; x < width - 1; x++)
 		{
@@ -80,74 +322,58 @@ int vc_gray_edge_sobel(IVC *src, IVC *dst, float th)
 			sumy /= 4.0f;
 
 			// Calculate the magnitude of the vector
-			datadst[posX] = (unsigned char)sqrt((double)(sumx * sumx + sumy * sumy));
+			datadst[posX] = (unsigned char)MIN(sqrt((double)(sumx * sumx + sumy * sumy)), SIZEOFUCHAR);
 		}
 	}
-
-	// Compute a grey level histogram
-	for (y = 1; y < height; y++)
-		for (x = 1; x < width; x++)
-			hist[datadst[y * bytesperline + x]]++;
-
-	/** Find the threshold
-	 * Threshold is defined by the intensity when we reach a desired percentage of pixels
-	*/
-	histmax = 0;
-	for (i = 0; i < GRAYLEVELS; i++)
-	{
-		histmax += hist[i];
-
-		// th = Sobel Threshold
-		if (histmax >= (size * th)) break;
-	}
-	histthreshold = i;
-
-	// Apply the threshold
-	for (y = 1; y < height; y++)
-		for (x = 1; x < width; x++)
-		{
-			posX = y * bytesperline + x;
-			if (datadst[posX] >= histthreshold)
-				datadst[posX] = SIZEOFUCHAR;
-			else
-				datadst[posX] = 0;
-		}
-
-	return 1;
 }
 
 /**
- * @summary: Prewitt edge detection
+ * @summary: Sobel gradient magnitude (no threshold). The image border is set to 0 and the magnitude saturates at the image maximum
  * @src: Receives the source image pointer
  * @dst: Receives the destination image pointer
- * @th: receives the edging threshold [0.001, 1.00]
  * @return: true if the operation succeeds, false if not
 */
-int vc_gray_edge_prewitt(IVC *src, IVC *dst, float th)
+int vc_gray_gradient_sobel(IVC *src, IVC *dst)
 {
-	// Local variavles
-	unsigned char *datasrc = (unsigned char *)src->data;
-	unsigned char *datadst = (unsigned char *)dst->data;
-	int channels = src->channels;
-	int width = src->width;
 	int height = src->height;
-	int bytesperline = src->bytesperline;
-	int x, y, i, posA, posB, posC, posD, posX, posE, posF, posG, posH, sumx, sumy, histmax, histthreshold;
-	int hist[GRAYLEVELS] = {0};
 
 	// Error check
 	if ((src->width <= MINWIDTH) || (src->height <= MINHEIGHT))
 		return 0;
-	if ((dst->width <= MINWIDTH) || (dst->height <= MINHEIGHT))
+	if ((src->width != dst->width) || (src->height != dst->height))
 		return 0;
 	if ((src->channels != VC_CH_1) || (dst->channels != VC_CH_1))
 		return 0;
+	if (VC_SAMPLESIZE(src->levels) != VC_SAMPLESIZE(dst->levels))
+		return 0;
+
+	// Clear the border, the operators can not be applied there
+	vc_gray_clear_border(dst);
+
+	// 16-bit samples, center weight 2
+	if (src->levels > SIZEOFUCHAR)
+		return vc_gray16_gradient(src, dst, 2, 1, height - 1);
+
+	vc_gray_sobel_rows(src, dst, 1, height - 1);
+
+	return 1;
+}
 
-	// Get the number of pixels of the image w*h
-	int size = width * height;
+/**
+ * @summary: Prewitt gradient magnitude of the rows [ystart, yend), 1 <= ystart, yend <= height - 1
+*/
+static void vc_gray_prewitt_rows(IVC *src, IVC *dst, int ystart, int yend)
+{
+	// Local variavles
+	unsigned char *datasrc = (unsigned char *)src->data;
+	unsigned char *datadst = (unsigned char *)dst->data;
+	int width = src->width;
+	long long bytesperline = src->bytesperline;
+	long long posA, posB, posC, posD, posX, posE, posF, posG, posH;
+	int x, y, sumx, sumy;
 
 	// Apply the operators in x and y axis (gradient), and calculate the magnitude of the vector
-	for (y = 1; y < height - 1; y++)
+	for (y = ystart; y < yend; y++)
 	{
 		for (x = 1; x < width - 1; x++)
 		{
@@ -181,41 +407,956 @@ int vc_gray_edge_prewitt(IVC *src, IVC *dst, float th)
 			sumy += datasrc[posH] * +1;
 			sumy /= 3.0f;
 
-			// Calculate the magnitude of the vector
-			datadst[posX] = (unsigned char)sqrt((double)(sumx * sumx + sumy * sumy));
-		}
-	}
+			// Calculate the magnitude of the vector
+			datadst[posX] = (unsigned char)MIN(sqrt((double)(sumx * sumx + sumy * sumy)), SIZEOFUCHAR);
+		}
+	}
+}
+
+/**
+ * @summary: Prewitt gradient magnitude (no threshold). The image border is set to 0 and the magnitude saturates at the image maximum
+ * @src: Receives the source image pointer
+ * @dst: Receives the destination image pointer
+ * @return: true if the operation succeeds, false if not
+*/
+int vc_gray_gradient_prewitt(IVC *src, IVC *dst)
+{
+	int height = src->height;
+
+	// Error check
+	if ((src->width <= MINWIDTH) || (src->height <= MINHEIGHT))
+		return 0;
+	if ((src->width != dst->width) || (src->height != dst->height))
+		return 0;
+	if ((src->channels != VC_CH_1) || (dst->channels != VC_CH_1))
+		return 0;
+	if (VC_SAMPLESIZE(src->levels) != VC_SAMPLESIZE(dst->levels))
+		return 0;
+
+	// Clear the border, the operators can not be applied there
+	vc_gray_clear_border(dst);
+
+	// 16-bit samples, center weight 1
+	if (src->levels > SIZEOFUCHAR)
+		return vc_gray16_gradient(src, dst, 1, 1, height - 1);
+
+	vc_gray_prewitt_rows(src, dst, 1, height - 1);
+
+	return 1;
+}
+
+/**
+ * @summary: Sets the first and last rows and columns of a gray image to 0
+ * @image: Receives the image pointer
+*/
+void vc_gray_clear_border(IVC *image)
+{
+	unsigned char *data = (unsigned char *)image->data;
+	long long bytesperline = image->bytesperline;
+	int samplesize = VC_SAMPLESIZE(image->levels);
+	int y;
+
+	memset(data, 0, bytesperline);
+	memset(data + (image->height - 1) * bytesperline, 0, bytesperline);
+
+	for (y = 1; y < image->height - 1; y++)
+	{
+		memset(data + y * bytesperline, 0, samplesize);
+		memset(data + y * bytesperline + (long long)(image->width - 1) * samplesize, 0, samplesize);
+	}
+}
+
+/**
+ * @summary: Accumulates the grey level histogram of the rows [ystart, yend), skipping the first column
+ * @src: Receives the gradient image pointer
+ * @ystart: Receives the first row
+ * @yend: Receives the row after the last one
+ * @hist: Receives the VC_HISTLEVELS(src->levels) histogram to add to
+ * @return: true if the operation succeeds, false if not
+*/
+int vc_gray_histogram(IVC *src, int ystart, int yend, long long *hist)
+{
+	unsigned char *data = (unsigned char *)src->data;
+	unsigned short *data16;
+	long long bytesperline = src->bytesperline;
+	int x, y;
+
+	if (src->channels != VC_CH_1)
+		return 0;
+
+	for (y = MAX(ystart, 0); y < MIN(yend, src->height); y++)
+	{
+		if (src->levels > SIZEOFUCHAR)
+		{
+			data16 = (unsigned short *)(data + y * bytesperline);
+			for (x = 1; x < src->width; x++)
+				hist[data16[x]]++;
+		}
+		else
+			for (x = 1; x < src->width; x++)
+				hist[data[y * bytesperline + x]]++;
+	}
+
+	return 1;
+}
+
+/**
+ * @summary: Finds the threshold grey level of a histogram
+ * Threshold is defined by the intensity when we reach a desired percentage of pixels
+ * @hist: Receives the histogram
+ * @nlevels: Receives the number of histogram levels, VC_HISTLEVELS(levels)
+ * @size: Receives the number of pixels of the whole image w*h
+ * @th: receives the edging threshold [0.001, 1.00]
+ * @return: the threshold grey level
+*/
+int vc_histogram_threshold(long long *hist, int nlevels, long long size, float th)
+{
+	long long histmax = 0;
+	int i;
+
+	for (i = 0; i < nlevels; i++)
+	{
+		histmax += hist[i];
+
+		// Compare in double, a float can not hold every pixel count past 2^24
+		if (histmax >= ((double)size * th)) break;
+	}
+
+	return i;
+}
+
+/**
+ * @summary: Binarizes the rows [ystart, yend) of a gray image in place, skipping the first column
+ * @image: Receives the image pointer
+ * @ystart: Receives the first row
+ * @yend: Receives the row after the last one
+ * @threshold: Receives the grey level threshold
+ * @return: true if the operation succeeds, false if not
+*/
+int vc_gray_binarize(IVC *image, int ystart, int yend, int threshold)
+{
+	unsigned char *data = (unsigned char *)image->data;
+	unsigned short *data16;
+	long long bytesperline = image->bytesperline;
+	long long posX;
+	int x, y;
+
+	if (image->channels != VC_CH_1)
+		return 0;
+
+	// 16-bit samples are set to the image maximum
+	if (image->levels > SIZEOFUCHAR)
+	{
+		for (y = MAX(ystart, 0); y < MIN(yend, image->height); y++)
+		{
+			data16 = (unsigned short *)(data + y * bytesperline);
+			for (x = 1; x < image->width; x++)
+				data16[x] = (data16[x] >= threshold) ? image->levels : 0;
+		}
+		return 1;
+	}
+
+	for (y = MAX(ystart, 0); y < MIN(yend, image->height); y++)
+		for (x = 1; x < image->width; x++)
+		{
+			posX = y * bytesperline + x;
+			if (data[posX] >= threshold)
+				data[posX] = SIZEOFUCHAR;
+			else
+				data[posX] = 0;
+		}
+
+	return 1;
+}
+
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// ROLLING ROW GRADIENT ENGINE
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+/**
+ * Source rows are converted to int samples into a ring of 2 * radius + 1 raw rows, smoothed with a
+ * separable Gaussian (vertical pass over the raw ring into tmp, horizontal pass into the ring) and
+ * kept in a ring of 3 rows from which the derivatives are taken. Every source row is converted once
+ * and reused from the raw ring for its 2 * radius + 1 vertical taps.
+*/
+typedef struct
+{
+	IVC *src;
+	int width, height, channels;
+	int n;						  // Samples per row, width * channels
+	int weight, div;			  // Center weight of the operator and its normalization
+	int radius;					  // Smoothing radius, 0 = no smoothing
+	int kernel[2 * VC_MAXRADIUS + 1]; // Smoothing weights, sum 1 << VC_SMOOTHSHIFT
+	int *ring[3];				  // Smoothed rows y - 1, y, y + 1 at slot row % 3
+	int next;					  // Next row to load into the ring
+	int *raw[2 * VC_MAXRADIUS + 1];	  // Source rows y - radius to y + radius, at slot vc_rows_slot(row)
+	int rawnext, rawvalid;		  // Next source row to convert into the raw ring, set on the first load
+	int *tmp;					  // Vertical smoothing pass
+	int *gx, *gy;				  // Derivatives of the current row, one plane of width samples per channel
+} VCROWS;
+
+/**
+ * @summary: Smoothing radius used for a sigma, 3x3 below 1.0 and 5x5 from there on
+ * @sigma: Receives the Gaussian sigma, 0 disables the smoothing
+ * @return: the radius in pixels
+*/
+int vc_smooth_radius(float sigma)
+{
+	if (sigma <= 0.0f)
+		return 0;
+
+	return (sigma < 1.0f) ? 1 : VC_MAXRADIUS;
+}
+
+/**
+ * @summary: Fixed point Gaussian weights of a sigma, summing 1 << VC_SMOOTHSHIFT. The rounding error
+ * goes to the center weight
+ * @sigma: Receives the Gaussian sigma, 0 disables the smoothing
+ * @kernel: Receives the 2 * VC_MAXRADIUS + 1 weights array, the first 2 * radius + 1 are set
+ * @return: the radius in pixels
+*/
+int vc_smooth_kernel(float sigma, int *kernel)
+{
+	double w[2 * VC_MAXRADIUS + 1], sum = 0.0;
+	int radius = vc_smooth_radius(sigma);
+	int i, total = 0;
+
+	// No smoothing, the identity (sigma 0 would divide by 0)
+	if (radius == 0)
+	{
+		kernel[0] = 1 << VC_SMOOTHSHIFT;
+		return 0;
+	}
+
+	for (i = -radius; i <= radius; i++)
+		sum += w[i + radius] = exp(-(double)(i * i) / (2.0 * sigma * sigma));
+	for (i = 0; i < 2 * radius + 1; i++)
+		total += kernel[i] = (int)(w[i] / sum * (1 << VC_SMOOTHSHIFT) + 0.5);
+	kernel[radius] += (1 << VC_SMOOTHSHIFT) - total;
+
+	return radius;
+}
+
+/**
+ * @summary: Prepares the engine for a source image
+ * @op: Receives VC_EDGE_SOBEL or VC_EDGE_PREWITT
+ * @sigma: Receives the Gaussian smoothing sigma, 0 = none
+ * @return: true if the operation succeeds, false if not
+*/
+static int vc_rows_init(VCROWS *rows, IVC *src, int op, float sigma)
+{
+	int i;
+
+	memset(rows, 0, sizeof(VCROWS));
+
+	rows->src = src;
+	rows->width = src->width;
+	rows->height = src->height;
+	rows->channels = src->channels;
+	rows->n = src->width * src->channels;
+	rows->weight = (op == VC_EDGE_SOBEL) ? 2 : 1;
+	rows->div = rows->weight + 2;
+	rows->radius = vc_smooth_kernel(sigma, rows->kernel);
+
+	for (i = 0; i < 3; i++)
+		rows->ring[i] = (int *)malloc(rows->n * sizeof(int));
+	for (i = 0; i < 2 * rows->radius + 1 && rows->radius > 0; i++)
+	{
+		rows->raw[i] = (int *)malloc(rows->n * sizeof(int));
+		if (!rows->raw[i])
+			return 0;
+	}
+	rows->tmp = (int *)malloc(rows->n * sizeof(int));
+	rows->gx = (int *)calloc(rows->n, sizeof(int));
+	rows->gy = (int *)calloc(rows->n, sizeof(int));
+
+	return rows->ring[0] && rows->ring[1] && rows->ring[2] && rows->tmp && rows->gx && rows->gy;
+}
+
+/**
+ * @summary: Frees the engine buffers
+*/
+static void vc_rows_free(VCROWS *rows)
+{
+	int i;
+
+	for (i = 0; i < 3; i++)
+		free(rows->ring[i]);
+	for (i = 0; i < 2 * VC_MAXRADIUS + 1; i++)
+		free(rows->raw[i]);
+	free(rows->tmp);
+	free(rows->gx);
+	free(rows->gy);
+}
+
+/**
+ * @summary: Loads source row y (clamped to the image) as int samples
+*/
+static void vc_rows_fetch(VCROWS *rows, int y, int *row)
+{
+	IVC *src = rows->src;
+	unsigned char *data;
+	unsigned short *data16;
+	int i;
+
+	y = MAX(0, MIN(y, rows->height - 1));
+	data = src->data + y * src->bytesperline;
+	data16 = (unsigned short *)data;
+
+	if (src->levels > SIZEOFUCHAR)
+		for (i = 0; i < rows->n; i++)
+			row[i] = data16[i];
+	else
+		for (i = 0; i < rows->n; i++)
+			row[i] = data[i];
+}
+
+/**
+ * @summary: Raw ring slot of source row y, rows above the image (down to -radius) included
+*/
+static int vc_rows_slot(VCROWS *rows, int y)
+{
+	int size = 2 * rows->radius + 1;
+
+	return ((y % size) + size) % size;
+}
+
+/**
+ * @summary: Loads the smoothed source row y into its ring slot
+*/
+static void vc_rows_load(VCROWS *rows, int y)
+{
+	int *row = rows->ring[y % 3];
+	int *tmp = rows->tmp;
+	int *k = rows->kernel;
+	int *raw;
+	int r = rows->radius, ch = rows->channels, n = rows->n;
+	int i, j, acc, border = MIN(r * ch, n);
+
+	if (r == 0)
+	{
+		vc_rows_fetch(rows, y, row);
+		return;
+	}
+
+	// Convert the source rows up to y + r not yet in the raw ring, once each
+	if (!rows->rawvalid || rows->rawnext < y - r)
+	{
+		rows->rawnext = y - r;
+		rows->rawvalid = 1;
+	}
+	while (rows->rawnext <= y + r)
+	{
+		vc_rows_fetch(rows, rows->rawnext, rows->raw[vc_rows_slot(rows, rows->rawnext)]);
+		rows->rawnext++;
+	}
+
+	// Vertical pass over the raw ring
+	memset(tmp, 0, n * sizeof(int));
+	for (j = -r; j <= r; j++)
+	{
+		raw = rows->raw[vc_rows_slot(rows, y + j)];
+		for (i = 0; i < n; i++)
+			tmp[i] += k[j + r] * raw[i];
+	}
+	for (i = 0; i < n; i++)
+		tmp[i] = (tmp[i] + (1 << (VC_SMOOTHSHIFT - 1))) >> VC_SMOOTHSHIFT;
+
+	// Horizontal pass
+	for (i = border; i < n - border; i++)
+	{
+		acc = 0;
+		for (j = -r; j <= r; j++)
+			acc += k[j + r] * tmp[i + j * ch];
+
+		row[i] = (acc + (1 << (VC_SMOOTHSHIFT - 1))) >> VC_SMOOTHSHIFT;
+	}
+
+	// The first and last columns, the image border is replicated
+	for (i = 0; i < n; i++)
+	{
+		if (i == border && n - border > border)
+			i = n - border;
+
+		acc = 0;
+		for (j = -r; j <= r; j++)
+			acc += k[j + r] * tmp[MAX(0, MIN(i / ch + j, rows->width - 1)) * ch + i % ch];
+
+		row[i] = (acc + (1 << (VC_SMOOTHSHIFT - 1))) >> VC_SMOOTHSHIFT;
+	}
+}
+
+/**
+ * @summary: Computes the x and y derivatives of row y (1 <= y < height - 1) into gx and gy,
+ * for the samples of the columns [1, width - 1), one plane of width samples per channel
+*/
+static void vc_rows_gradient(VCROWS *rows, int y)
+{
+	int *a, *b, *c, *gx = rows->gx, *gy = rows->gy;
+	int ch = rows->channels, width = rows->width;
+	int i, k, x;
+
+	while (rows->next <= y + 1)
+		vc_rows_load(rows, rows->next++);
+
+	a = rows->ring[(y - 1) % 3];
+	b = rows->ring[y % 3];
+	c = rows->ring[(y + 1) % 3];
+
+	// One loop per operator, a division by a constant vectorizes and one by a variable does not.
+	// Channel k of column x goes to k * width + x, so the magnitude loops read contiguous planes
+	for (k = 0; k < ch; k++, a++, b++, c++, gx += width, gy += width)
+	{
+		if (rows->weight == 2)
+			for (x = 1; x < width - 1; x++)
+			{
+				i = x * ch;
+				gx[x] = ((a[i + ch] - a[i - ch]) + 2 * (b[i + ch] - b[i - ch]) + (c[i + ch] - c[i - ch])) / 4;
+				gy[x] = ((c[i - ch] - a[i - ch]) + 2 * (c[i] - a[i]) + (c[i + ch] - a[i + ch])) / 4;
+			}
+		else
+			for (x = 1; x < width - 1; x++)
+			{
+				i = x * ch;
+				gx[x] = ((a[i + ch] - a[i - ch]) + (b[i + ch] - b[i - ch]) + (c[i + ch] - c[i - ch])) / 3;
+				gy[x] = ((c[i - ch] - a[i - ch]) + (c[i] - a[i]) + (c[i + ch] - a[i + ch])) / 3;
+			}
+	}
+}
+
+/**
+ * @summary: Quantized direction of a gradient vector, VC_DIR_0 (horizontal gradient, vertical edge),
+ * VC_DIR_45, VC_DIR_90 or VC_DIR_135, with the y axis pointing down
+*/
+static unsigned char vc_direction(double gx, double gy)
+{
+	double ax = fabs(gx), ay = fabs(gy);
+
+	if (ay <= ax * VC_TAN22)
+		return VC_DIR_0;
+	if (ax <= ay * VC_TAN22)
+		return VC_DIR_90;
+
+	return ((gx > 0) == (gy > 0)) ? VC_DIR_45 : VC_DIR_135;
+}
+
+/**
+ * @summary: Gradient magnitude (saturated at maximum) of the columns [1, width - 1) of the current row.
+ * One branch free loop per mode, so each of them vectorizes
+ * @color: Receives VC_COLOR_MAX or VC_COLOR_DIZENZO for RGB rows
+*/
+static void vc_rows_magnitude(VCROWS *rows, int color, int maximum, int *mag)
+{
+	int *gx = rows->gx, *gy = rows->gy;
+	int x, width = rows->width;
+	int *gx1 = gx + width, *gy1 = gy + width, *gx2 = gx + 2 * width, *gy2 = gy + 2 * width;
+	double g0, g1, g2, gxx, gyy, gxy, g;
+
+	if (rows->channels == VC_CH_1)
+	{
+		for (x = 1; x < width - 1; x++)
+		{
+			g = (double)gx[x] * gx[x] + (double)gy[x] * gy[x];
+			mag[x] = (int)MIN(sqrt(g), maximum);
+		}
+	}
+	else if (color == VC_COLOR_DIZENZO)
+	{
+		// Structure tensor [gxx gxy; gxy gyy] summed over the channels, g is its largest eigenvalue
+		for (x = 1; x < width - 1; x++)
+		{
+			gxx = (double)gx[x] * gx[x] + (double)gx1[x] * gx1[x] + (double)gx2[x] * gx2[x];
+			gyy = (double)gy[x] * gy[x] + (double)gy1[x] * gy1[x] + (double)gy2[x] * gy2[x];
+			gxy = (double)gx[x] * gy[x] + (double)gx1[x] * gy1[x] + (double)gx2[x] * gy2[x];
+			g = 0.5 * (gxx + gyy + sqrt((gxx - gyy) * (gxx - gyy) + 4.0 * gxy * gxy));
+			mag[x] = (int)MIN(sqrt(g), maximum);
+		}
+	}
+	else
+	{
+		// Channel with the largest gradient, the first one on ties
+		for (x = 1; x < width - 1; x++)
+		{
+			g0 = (double)gx[x] * gx[x] + (double)gy[x] * gy[x];
+			g1 = (double)gx1[x] * gx1[x] + (double)gy1[x] * gy1[x];
+			g2 = (double)gx2[x] * gx2[x] + (double)gy2[x] * gy2[x];
+			g = (g1 > g0) ? g1 : g0;
+			g = (g2 > g) ? g2 : g;
+			mag[x] = (int)MIN(sqrt(g), maximum);
+		}
+	}
+}
+
+/**
+ * @summary: Quantized gradient direction of the columns [1, width - 1) of the current row, for the
+ * non-maximum suppression. Scalar, the magnitude loops stay branch free
+ * @color: Receives VC_COLOR_MAX or VC_COLOR_DIZENZO for RGB rows
+*/
+static void vc_rows_direction(VCROWS *rows, int color, unsigned char *dir)
+{
+	int *gx, *gy;
+	int x, c, best, width = rows->width;
+	double gxx, gyy, gxy, g;
+
+	for (x = 1; x < width - 1; x++)
+	{
+		// Channel c of the column at gx[c * width]
+		gx = rows->gx + x;
+		gy = rows->gy + x;
+
+		if (rows->channels == VC_CH_1)
+			dir[x] = vc_direction(gx[0], gy[0]);
+		else if (color == VC_COLOR_DIZENZO)
+		{
+			gxx = gyy = gxy = 0.0;
+			for (c = 0; c < rows->channels; c++)
+			{
+				gxx += (double)gx[c * width] * gx[c * width];
+				gyy += (double)gy[c * width] * gy[c * width];
+				gxy += (double)gx[c * width] * gy[c * width];
+			}
+			g = 0.5 * (gxx + gyy + sqrt((gxx - gyy) * (gxx - gyy) + 4.0 * gxy * gxy));
+
+			// Direction of the eigenvector of g
+			dir[x] = (gxy != 0.0) ? vc_direction(g - gyy, gxy) : ((gxx >= gyy) ? VC_DIR_0 : VC_DIR_90);
+		}
+		else
+		{
+			best = 0;
+			for (c = 1; c < rows->channels; c++)
+				if ((double)gx[c * width] * gx[c * width] + (double)gy[c * width] * gy[c * width] > (double)gx[best * width] * gx[best * width] + (double)gy[best * width] * gy[best * width])
+					best = c;
+			dir[x] = vc_direction(gx[best * width], gy[best * width]);
+		}
+	}
+}
+
+/**
+ * @summary: Stores the columns [1, width - 1) of a magnitude row in row y of a gray image
+*/
+static void vc_rows_store(IVC *dst, int y, int *mag)
+{
+	unsigned char *data = dst->data + y * dst->bytesperline;
+	unsigned short *data16 = (unsigned short *)data;
+	int x;
+
+	if (dst->levels > SIZEOFUCHAR)
+		for (x = 1; x < dst->width - 1; x++)
+			data16[x] = (unsigned short)mag[x];
+	else
+		for (x = 1; x < dst->width - 1; x++)
+			data[x] = (unsigned char)mag[x];
+}
+
+/**
+ * @summary: Non-maximum suppression of row y, keeping the magnitudes that are a maximum across the
+ * edge. mag and dir are rings of 3 rows at slot row % 3. orient, when not NULL, receives
+ * (direction + 1) * VC_ORIENTSTEP on the kept pixels and 0 elsewhere
+*/
+static void vc_rows_suppress(IVC *dst, IVC *orient, int y, int *mag[3], unsigned char *dir[3])
+{
+	int *a = mag[(y - 1) % 3], *b = mag[y % 3], *c = mag[(y + 1) % 3];
+	unsigned char *d = dir[y % 3];
+	unsigned char *datadst = dst->data + y * dst->bytesperline;
+	unsigned short *datadst16 = (unsigned short *)datadst;
+	unsigned char *dataorient = orient ? orient->data + y * orient->bytesperline : NULL;
+	int x, n1, n2, v;
+
+	for (x = 1; x < dst->width - 1; x++)
+	{
+		// Neighbours across the edge
+		switch (d[x])
+		{
+		case VC_DIR_0:
+			n1 = b[x - 1];
+			n2 = b[x + 1];
+			break;
+		case VC_DIR_45:
+			n1 = a[x - 1];
+			n2 = c[x + 1];
+			break;
+		case VC_DIR_90:
+			n1 = a[x];
+			n2 = c[x];
+			break;
+		default:
+			n1 = a[x + 1];
+			n2 = c[x - 1];
+			break;
+		}
+
+		// On a plateau only the last pixel is kept
+		v = (b[x] >= n1 && b[x] > n2) ? b[x] : 0;
+
+		if (dst->levels > SIZEOFUCHAR)
+			datadst16[x] = (unsigned short)v;
+		else
+			datadst[x] = (unsigned char)v;
+
+		if (dataorient)
+			dataorient[x] = v ? (unsigned char)((d[x] + 1) * VC_ORIENTSTEP) : 0;
+	}
+}
+
+/**
+ * @summary: Runs the engine over the rows [ystart, yend), 1 <= ystart, yend <= height - 1, storing the
+ * gradient magnitude in dst. With nms, the magnitude rows go through a ring of 3 rows and row y - 1 is
+ * suppressed as soon as row y is known, the rows next to the range are computed but not stored
+ * @return: true if the operation succeeds, false if not
+*/
+static int vc_rows_edge(IVC *src, IVC *dst, IVC *orient, int op, float sigma, int color, int nms, int ystart, int yend)
+{
+	VCROWS rows;
+	int *mag[3] = {NULL, NULL, NULL};
+	unsigned char *dir[3] = {NULL, NULL, NULL};
+	int maximum = MAX(dst->levels, SIZEOFUCHAR);
+	int yfirst = nms ? MAX(ystart - 1, 1) : ystart;
+	int ylast = nms ? MIN(yend + 1, src->height - 1) : yend;
+	int y, i, ok;
+
+	ok = vc_rows_init(&rows, src, op, sigma);
+
+	// The first and last columns stay 0, as does the magnitude of row 0
+	for (i = 0; i < (nms ? 3 : 1); i++)
+	{
+		mag[i] = (int *)calloc(src->width, sizeof(int));
+		dir[i] = nms ? (unsigned char *)calloc(src->width, sizeof(unsigned char)) : NULL;
+		ok = ok && mag[i] && (!nms || dir[i]);
+	}
+
+	if (ok)
+	{
+		// The ring starts with the row above the range
+		rows.next = yfirst - 1;
+
+		for (y = yfirst; y < ylast; y++)
+		{
+			vc_rows_gradient(&rows, y);
+
+			if (!nms)
+			{
+				vc_rows_magnitude(&rows, color, maximum, mag[0]);
+				vc_rows_store(dst, y, mag[0]);
+				continue;
+			}
+
+			vc_rows_magnitude(&rows, color, maximum, mag[y % 3]);
+			vc_rows_direction(&rows, color, dir[y % 3]);
+			if (y - 1 >= ystart)
+				vc_rows_suppress(dst, orient, y - 1, mag, dir);
+		}
+
+		// The last image row has no magnitude, only the strip that ends there suppresses the row above it
+		if (nms && ylast == src->height - 1 && ylast - 1 >= ystart && ylast - 1 < yend)
+		{
+			memset(mag[ylast % 3], 0, src->width * sizeof(int));
+			vc_rows_suppress(dst, orient, ylast - 1, mag, dir);
+		}
+	}
+
+	for (i = 0; i < 3; i++)
+	{
+		free(mag[i]);
+		free(dir[i]);
+	}
+	vc_rows_free(&rows);
+
+	return ok;
+}
+
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// STRIPS AND THREADS
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+/**
+ * The rows [1, height - 1) of a gradient pass are split in strips of tune.striprows rows, and strip
+ * i goes to thread i % tune.threads. Strips write disjoint rows of dst and only read src, so the
+ * threads share nothing but the job description. Row engine passes use tune.enginestriprows and
+ * tune.enginethreads instead, since every strip primes the row ring again.
+*/
+
+// Execution of the gradient passes, set by vc_set_tune()
+static VCTUNE vc_tune = {VC_KERNEL_DIRECT, 0, 1, 0, 1};
+
+/**
+ * @summary: Selects the kernel, strip height and thread count of the gradient passes
+ * @tune: Receives the configuration, usually found by the edge --autotune benchmark
+*/
+void vc_set_tune(VCTUNE *tune)
+{
+	vc_tune.kernel = (tune->kernel >= VC_KERNEL_DIRECT && tune->kernel <= VC_KERNEL_RUNSUM) ? tune->kernel : VC_KERNEL_DIRECT;
+	vc_tune.striprows = MAX(tune->striprows, 0);
+	vc_tune.threads = MAX(1, MIN(tune->threads, VC_MAXTHREADS));
+	vc_tune.enginestriprows = MAX(tune->enginestriprows, 0);
+	vc_tune.enginethreads = MAX(1, MIN(tune->enginethreads, VC_MAXTHREADS));
+}
+
+/**
+ * @summary: Current kernel, strip height and thread count of the gradient passes
+*/
+void vc_get_tune(VCTUNE *tune)
+{
+	*tune = vc_tune;
+}
+
+typedef struct
+{
+	IVC *src, *dst, *orient;
+	int op;
+	float sigma;
+	int color, nms;
+	int engine;	   // Rolling row engine, else the unsmoothed gray kernels
+	VCTUNE tune;
+	int striprows, nstrips;
+} VCSTRIPS;
+
+typedef struct
+{
+	VCSTRIPS *job;
+	int index; // Thread index, runs the strips index, index + threads, ...
+	int ok;
+} VCWORKER;
+
+/**
+ * @summary: Unsmoothed gray gradient of the rows [ystart, yend) with the selected kernel
+ * @return: true if the operation succeeds, false if not
+*/
+static int vc_kernel_rows(IVC *src, IVC *dst, int op, int kernel, int ystart, int yend)
+{
+	int weight = (op == VC_EDGE_SOBEL) ? 2 : 1;
+
+	if (kernel == VC_KERNEL_RUNSUM)
+		return vc_gray_runsum_gradient(src, dst, weight, ystart, yend);
+	else if (src->levels > SIZEOFUCHAR)
+		vc_gray16_gradient(src, dst, weight, ystart, yend);
+	else if (kernel == VC_KERNEL_ROWS)
+		vc_gray8_gradient(src, dst, weight, ystart, yend);
+	else if (op == VC_EDGE_SOBEL)
+		vc_gray_sobel_rows(src, dst, ystart, yend);
+	else
+		vc_gray_prewitt_rows(src, dst, ystart, yend);
+
+	return 1;
+}
+
+/**
+ * @summary: Runs the strips of a thread
+*/
+static void *vc_strips_worker(void *arg)
+{
+	VCWORKER *worker = (VCWORKER *)arg;
+	VCSTRIPS *job = worker->job;
+	int i, ystart, yend;
+
+	worker->ok = 1;
+	for (i = worker->index; i < job->nstrips; i += job->tune.threads)
+	{
+		ystart = 1 + i * job->striprows;
+		yend = MIN(ystart + job->striprows, job->src->height - 1);
+
+		if (job->engine)
+			worker->ok = vc_rows_edge(job->src, job->dst, job->orient, job->op, job->sigma, job->color, job->nms, ystart, yend) && worker->ok;
+		else
+			worker->ok = vc_kernel_rows(job->src, job->dst, job->op, job->tune.kernel, ystart, yend) && worker->ok;
+	}
+
+	return NULL;
+}
+
+/**
+ * @summary: Clears the border of the outputs and runs a gradient pass over strips, on the threads of the tune
+ * @return: true if the operation succeeds, false if not
+*/
+static int vc_strips_run(VCSTRIPS *job)
+{
+	VCWORKER workers[VC_MAXTHREADS];
+#ifdef __linux__
+	pthread_t threads[VC_MAXTHREADS];
+	int started[VC_MAXTHREADS];
+#endif
+	int rows = job->src->height - 2;
+	int i, ok = 1;
+
+	// Clear the border, the operators can not be applied there
+	vc_gray_clear_border(job->dst);
+	if (job->orient)
+		vc_gray_clear_border(job->orient);
+
+	if (rows <= 0)
+		return 1;
+
+	// Strip height 0 is one strip per thread
+	job->tune = vc_tune;
+	if (job->engine)
+	{
+		job->tune.striprows = vc_tune.enginestriprows;
+		job->tune.threads = vc_tune.enginethreads;
+	}
+	job->striprows = (job->tune.striprows > 0) ? job->tune.striprows : (rows + job->tune.threads - 1) / job->tune.threads;
+	job->nstrips = (rows + job->striprows - 1) / job->striprows;
+	job->tune.threads = MIN(job->tune.threads, job->nstrips);
+
+	for (i = 0; i < job->tune.threads; i++)
+	{
+		workers[i].job = job;
+		workers[i].index = i;
+	}
+
+#ifdef __linux__
+	// The calling thread runs worker 0, a worker whose thread can not be started runs here too
+	for (i = 1; i < job->tune.threads; i++)
+		started[i] = pthread_create(&threads[i], NULL, vc_strips_worker, &workers[i]) == 0;
+	vc_strips_worker(&workers[0]);
+	for (i = 1; i < job->tune.threads; i++)
+	{
+		if (started[i])
+			pthread_join(threads[i], NULL);
+		else
+			vc_strips_worker(&workers[i]);
+	}
+#else
+	for (i = 0; i < job->tune.threads; i++)
+		vc_strips_worker(&workers[i]);
+#endif
+
+	for (i = 0; i < job->tune.threads; i++)
+		ok = ok && workers[i].ok;
+
+	return ok;
+}
+
+/**
+ * @summary: Gradient pass of the rolling row engine over strips
+*/
+static int vc_rows_run(IVC *src, IVC *dst, IVC *orient, int op, float sigma, int color, int nms)
+{
+	VCSTRIPS job;
+
+	memset(&job, 0, sizeof(VCSTRIPS));
+	job.src = src;
+	job.dst = dst;
+	job.orient = orient;
+	job.op = op;
+	job.sigma = sigma;
+	job.color = color;
+	job.nms = nms;
+	job.engine = 1;
+
+	return vc_strips_run(&job);
+}
+
+/**
+ * @summary: Sobel or Prewitt gradient magnitude of a gray image, smoothed in the same pass.
+ * The image border is set to 0 and the magnitude saturates at the image maximum
+ * @src: Receives the source image pointer
+ * @dst: Receives the destination image pointer
+ * @op: Receives VC_EDGE_SOBEL or VC_EDGE_PREWITT
+ * @sigma: Receives the Gaussian smoothing sigma, 0 = none
+ * @return: true if the operation succeeds, false if not
+*/
+int vc_gray_gradient_smooth(IVC *src, IVC *dst, int op, float sigma)
+{
+	// Error check
+	if ((src->width <= MINWIDTH) || (src->height <= MINHEIGHT))
+		return 0;
+	if ((src->width != dst->width) || (src->height != dst->height))
+		return 0;
+	if ((src->channels != VC_CH_1) || (dst->channels != VC_CH_1))
+		return 0;
+	if (VC_SAMPLESIZE(src->levels) != VC_SAMPLESIZE(dst->levels))
+		return 0;
+
+	return vc_rows_run(src, dst, NULL, op, sigma, 0, 0);
+}
+
+/**
+ * @summary: Color gradient magnitude of a RGB image, taken from the per channel derivatives without
+ * gray conversion. The image border is set to 0 and the magnitude saturates at the image maximum
+ * @src: Receives the source RGB image pointer
+ * @dst: Receives the destination gray image pointer
+ * @op: Receives VC_EDGE_SOBEL or VC_EDGE_PREWITT
+ * @sigma: Receives the Gaussian smoothing sigma, 0 = none
+ * @mode: Receives VC_COLOR_MAX (channel with the largest gradient) or VC_COLOR_DIZENZO
+ * (square root of the largest eigenvalue of the Di Zenzo structure tensor)
+ * @return: true if the operation succeeds, false if not
+*/
+int vc_rgb_gradient(IVC *src, IVC *dst, int op, float sigma, int mode)
+{
+	// Error check
+	if ((src->width <= MINWIDTH) || (src->height <= MINHEIGHT))
+		return 0;
+	if ((src->width != dst->width) || (src->height != dst->height))
+		return 0;
+	if ((src->channels != VC_CH_3) || (dst->channels != VC_CH_1))
+		return 0;
+	if (VC_SAMPLESIZE(src->levels) != VC_SAMPLESIZE(dst->levels))
+		return 0;
+
+	return vc_rows_run(src, dst, NULL, op, sigma, mode, 0);
+}
+
+/**
+ * @summary: Thin edges, gradient magnitude with non-maximum suppression in the same pass. Only the
+ * pixels that are a maximum across the edge keep their magnitude, the others are set to 0
+ * @src: Receives the source gray image pointer, or RGB with a color mode
+ * @dst: Receives the destination gray image pointer
+ * @orient: Receives the optional 8-bit orientation map pointer (NULL if not needed). Kept pixels
+ * are set to (direction + 1) * VC_ORIENTSTEP, direction being VC_DIR_0 to VC_DIR_135, others to 0
+ * @op: Receives VC_EDGE_SOBEL or VC_EDGE_PREWITT
+ * @sigma: Receives the Gaussian smoothing sigma, 0 = none
+ * @color: Receives VC_COLOR_MAX or VC_COLOR_DIZENZO for RGB images
+ * @return: true if the operation succeeds, false if not
+*/
+int vc_gradient_nms(IVC *src, IVC *dst, IVC *orient, int op, float sigma, int color)
+{
+	// Error check
+	if ((src->width <= MINWIDTH) || (src->height <= MINHEIGHT))
+		return 0;
+	if ((src->width != dst->width) || (src->height != dst->height))
+		return 0;
+	if (!((src->channels == VC_CH_1) || (src->channels == VC_CH_3 && color)) || (dst->channels != VC_CH_1))
+		return 0;
+	if (VC_SAMPLESIZE(src->levels) != VC_SAMPLESIZE(dst->levels))
+		return 0;
+	if (orient && ((orient->width != src->width) || (orient->height != src->height) || (orient->channels != VC_CH_1) || (orient->levels > SIZEOFUCHAR)))
+		return 0;
+
+	return vc_rows_run(src, dst, orient, op, sigma, color, 1);
+}
 
-	// Compute a grey level histogram
-	for (y = 1; y < height; y++)
-		for (x = 1; x < width; x++)
-			hist[datadst[y * bytesperline + x]]++;
+/**
+ * @summary: Gradient magnitude with the given operator and smoothing. Without smoothing the
+ * kernel selected by vc_set_tune() is used, all of them give the vc_gray_gradient_sobel and
+ * vc_gray_gradient_prewitt results
+ * @src: Receives the source image pointer
+ * @dst: Receives the destination image pointer
+ * @op: Receives VC_EDGE_SOBEL or VC_EDGE_PREWITT
+ * @sigma: Receives the Gaussian smoothing sigma, 0 = none
+ * @return: true if the operation succeeds, false if not
+*/
+int vc_gray_gradient(IVC *src, IVC *dst, int op, float sigma)
+{
+	VCSTRIPS job;
 
-	/** Find the threshold
-	 * Threshold is defined by the intensity when we reach a desired percentage of pixels
-	*/
-	histmax = 0;
-	for (i = 0; i < GRAYLEVELS; i++)
-	{
-		histmax += hist[i];
+	if (sigma > 0.0f)
+		return vc_gray_gradient_smooth(src, dst, op, sigma);
 
-		// th = Prewitt Threshold
-		if (histmax >= (size * th)) break;
-	}
-	histthreshold = i;
+	// Error check
+	if ((src->width <= MINWIDTH) || (src->height <= MINHEIGHT))
+		return 0;
+	if ((src->width != dst->width) || (src->height != dst->height))
+		return 0;
+	if ((src->channels != VC_CH_1) || (dst->channels != VC_CH_1))
+		return 0;
+	if (VC_SAMPLESIZE(src->levels) != VC_SAMPLESIZE(dst->levels))
+		return 0;
 
-	// Apply the threshold
-	for (y = 1; y < height; y++)
-		for (x = 1; x < width; x++)
-		{
-			posX = y * bytesperline + x;
-			if (datadst[posX] >= histthreshold)
-				datadst[posX] = SIZEOFUCHAR;
-			else
-				datadst[posX] = 0;
-		}
+	memset(&job, 0, sizeof(VCSTRIPS));
+	job.src = src;
+	job.dst = dst;
+	job.op = op;
 
-	return 1;
+	return vc_strips_run(&job);
 }
 
 //+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
@@ -231,15 +1372,15 @@ int vc_gray_edge_prewitt(IVC *src, IVC *dst, float th)
 int vc_rgb_to_gray(IVC *src, IVC *dst)
 {
 	unsigned char *datasrc = (unsigned char *)src->data;
-	int bytesPerLine_src = src->width * src->channels;
+	long long bytesPerLine_src = (long long)src->width * src->channels;
 	int channels_src = src->channels;
 	unsigned char *datadst = (unsigned char *)dst->data;
-	int bytesPerLine_dst = dst->width * dst->channels;
+	long long bytesPerLine_dst = (long long)dst->width * dst->channels;
 	int channels_dst = dst->channels;
 	int width = src->width;
 	int height = src->height;
 	int x, y;
-	long int pos_src, pos_dst;
+	long long pos_src, pos_dst;
 	float rf, gf, bf;
 
 	// Error check
@@ -249,6 +1390,22 @@ int vc_rgb_to_gray(IVC *src, IVC *dst)
 		return 0;
 	if ((src->channels != VC_CH_3) || (dst->channels != VC_CH_1))
 		return 0;
+	if (VC_SAMPLESIZE(src->levels) != VC_SAMPLESIZE(dst->levels))
+		return 0;
+
+	// 16-bit samples
+	if (src->levels > SIZEOFUCHAR)
+	{
+		for (y = 0; y < height; y++)
+		{
+			unsigned short *rowsrc = (unsigned short *)datasrc + y * bytesPerLine_src;
+			unsigned short *rowdst = (unsigned short *)datadst + y * bytesPerLine_dst;
+
+			for (x = 0; x < width; x++)
+				rowdst[x] = (unsigned short)((rowsrc[3 * x] * 0.299) + (rowsrc[3 * x + 1] * 0.587) + (rowsrc[3 * x + 2] * 0.114));
+		}
+		return 1;
+	}
 
 	// Convert image to gray scale
 	for (y = 0; y < height; y++)
@@ -272,6 +1429,55 @@ int vc_rgb_to_gray(IVC *src, IVC *dst)
 // Image Memory Alloc & Free
 //+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 
+// Huge page policy for the image data, set by vc_set_hugepages()
+static int vc_hugepages = VC_HUGEPAGES_NONE;
+
+/**
+ * @summary: Selects how large image buffers are backed
+ * @mode: VC_HUGEPAGES_NONE, VC_HUGEPAGES_TRANSPARENT (madvise) or VC_HUGEPAGES_EXPLICIT (MAP_HUGETLB,
+ * falling back to transparent huge pages when the pool is empty)
+*/
+void vc_set_hugepages(int mode)
+{
+	vc_hugepages = mode;
+}
+
+/**
+ * @summary: Allocates size bytes of image data following the huge page policy
+ * @size: Receives the number of bytes
+ * @alloc: Receives the pointer where the VC_HUGEPAGES_* allocation used is stored
+ * @return pointer to the data or NULL
+*/
+static unsigned char *vc_data_alloc(size_t size, int *alloc)
+{
+#ifdef __linux__
+	void *data;
+
+	// Only worth it when the buffer spans several huge pages
+	if ((vc_hugepages == VC_HUGEPAGES_EXPLICIT) && (size >= VC_HUGEPAGESIZE))
+	{
+		data = mmap(NULL, VC_HUGEPAGEROUND(size), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (data != MAP_FAILED)
+		{
+			*alloc = VC_HUGEPAGES_EXPLICIT;
+			return (unsigned char *)data;
+		}
+	}
+	if ((vc_hugepages != VC_HUGEPAGES_NONE) && (size >= VC_HUGEPAGESIZE))
+	{
+		if (posix_memalign(&data, VC_HUGEPAGESIZE, size) == 0)
+		{
+			madvise(data, size, MADV_HUGEPAGE);
+			*alloc = VC_HUGEPAGES_TRANSPARENT;
+			return (unsigned char *)data;
+		}
+	}
+#endif
+
+	*alloc = VC_HUGEPAGES_NONE;
+	return (unsigned char *)malloc(size);
+}
+
 /**
  * @summary: Memory alloc for a image by parameters
  * @width: Receives the image width
@@ -282,17 +1488,19 @@ int vc_rgb_to_gray(IVC *src, IVC *dst)
 */
 IVC *vc_image_new(int width, int height, int channels, int levels)
 {
-	IVC *image = (IVC *)malloc(sizeof(IVC));
+	IVC *image = NULL;
+
+	if ((levels <= 0) || (levels > SIZEOFUSHORT)) return NULL;
 
+	image = (IVC *)malloc(sizeof(IVC));
 	if (!image) return NULL;
-	if ((levels <= 0) || (levels > SIZEOFUCHAR)) return NULL;
 
 	image->width = width;
 	image->height = height;
 	image->channels = channels;
 	image->levels = levels;
-	image->bytesperline = image->width * image->channels;
-	image->data = (unsigned char *)malloc(image->width * image->height * image->channels * sizeof(char));
+	image->bytesperline = (long long)image->width * image->channels * VC_SAMPLESIZE(levels);
+	image->data = vc_data_alloc((size_t)image->bytesperline * image->height * sizeof(char), &image->alloc);
 
 	if (!image->data) return vc_image_free(image);
 
@@ -309,12 +1517,19 @@ IVC *vc_image_free(IVC *image)
 	if (image != NULL)
 	{
 		if (image->data != NULL)
-			free(image->data);
+		{
+#ifdef __linux__
+			if (image->alloc == VC_HUGEPAGES_EXPLICIT)
+				munmap(image->data, VC_HUGEPAGEROUND((size_t)image->bytesperline * image->height));
+			else
+#endif
+				free(image->data);
+		}
 
 		free(image);
 	}
 
-	return image;
+	return NULL;
 }
 
 //+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
@@ -358,11 +1573,11 @@ char *netpbm_get_token(FILE *file, char *tok, int len)
 	return tok;
 }
 
-long int unsigned_char_to_bit(unsigned char *datauchar, unsigned char *databit, int width, int height)
+long long unsigned_char_to_bit(unsigned char *datauchar, unsigned char *databit, int width, int height)
 {
 	int x, y;
 	int countbits;
-	long int pos, counttotalbytes;
+	long long pos, counttotalbytes;
 	unsigned char *p = databit;
 
 	*p = 0;
@@ -373,7 +1588,7 @@ long int unsigned_char_to_bit(unsigned char *datauchar, unsigned char *databit,
 	{
 		for (x = 0; x < width; x++)
 		{
-			pos = width * y + x;
+			pos = (long long)width * y + x;
 
 			if (countbits <= 8)
 			{
@@ -397,7 +1612,7 @@ void bit_to_unsigned_char(unsigned char *databit, unsigned char *datauchar, int
 {
 	int x, y;
 	int countbits;
-	long int pos;
+	long long pos;
 	unsigned char *p = databit;
 
 	countbits = 1;
@@ -406,7 +1621,7 @@ void bit_to_unsigned_char(unsigned char *databit, unsigned char *datauchar, int
 	{
 		for (x = 0; x < width; x++)
 		{
-			pos = width * y + x;
+			pos = (long long)width * y + x;
 
 			if (countbits <= 8)
 			{
@@ -422,6 +1637,71 @@ void bit_to_unsigned_char(unsigned char *databit, unsigned char *datauchar, int
 	}
 }
 
+/**
+ * @summary: Converts 16-bit Netpbm samples (most significant byte first) to host order in place
+ * @data: Receives the samples
+ * @count: Receives the number of samples
+*/
+void netpbm_be16_to_host(unsigned char *data, long long count)
+{
+	unsigned short *p = (unsigned short *)data;
+	long long i;
+
+	for (i = 0; i < count; i++)
+		p[i] = (unsigned short)((data[2 * i] << 8) | data[2 * i + 1]);
+}
+
+/**
+ * @summary: Converts 16-bit host order samples to Netpbm byte order
+ * @src: Receives the samples
+ * @dst: Receives the destination buffer of 2 * count bytes
+ * @count: Receives the number of samples
+*/
+void netpbm_host_to_be16(unsigned char *src, unsigned char *dst, long long count)
+{
+	unsigned short *p = (unsigned short *)src;
+	long long i;
+
+	for (i = 0; i < count; i++)
+	{
+		dst[2 * i] = (unsigned char)(p[i] >> 8);
+		dst[2 * i + 1] = (unsigned char)(p[i] & 0xFF);
+	}
+}
+
+/**
+ * @summary: Writes rows of an image, converting 16-bit samples to Netpbm byte order
+ * @file: Receives the opened file
+ * @image: Receives the image pointer
+ * @ystart: Receives the first row
+ * @yend: Receives the row after the last one
+ * @return True if success, or false if not
+*/
+int netpbm_write_rows(FILE *file, IVC *image, int ystart, int yend)
+{
+	unsigned char *tmp;
+	int y;
+
+	if (image->levels <= SIZEOFUCHAR)
+		return fwrite(image->data + ystart * image->bytesperline, image->bytesperline, yend - ystart, file) == (size_t)(yend - ystart);
+
+	tmp = (unsigned char *)malloc(image->bytesperline);
+	if (!tmp) return 0;
+
+	for (y = ystart; y < yend; y++)
+	{
+		netpbm_host_to_be16(image->data + y * image->bytesperline, tmp, image->bytesperline / 2);
+		if (fwrite(tmp, image->bytesperline, 1, file) != 1)
+		{
+			free(tmp);
+			return 0;
+		}
+	}
+
+	free(tmp);
+	return 1;
+}
+
 /**
  * @summary: Read Image
  * @filename: Receives the file name and extension
@@ -433,10 +1713,10 @@ IVC *vc_read_image(char *filename)
 	IVC *image = NULL;
 	unsigned char *tmp;
 	char tok[20];
-	long int size, sizeofbinarydata;
+	long long size, sizeofbinarydata;
 	int width, height, channels;
 	int levels = SIZEOFUCHAR;
-	int v;
+	size_t v;
 
 	if ((file = fopen(filename, "rb")) != NULL)
 	{
@@ -479,7 +1759,7 @@ IVC *vc_read_image(char *filename)
 			image = vc_image_new(width, height, channels, levels);
 			if (!image) return NULL;
 
-			sizeofbinarydata = (image->width / 8 + ((image->width % 8) ? 1 : 0)) * image->height;
+			sizeofbinarydata = (long long)(image->width / 8 + ((image->width % 8) ? 1 : 0)) * image->height;
 			tmp = (unsigned char *)malloc(sizeofbinarydata);
 			if (!tmp) return 0;
 
@@ -507,7 +1787,7 @@ IVC *vc_read_image(char *filename)
 		{
 			if (sscanf(netpbm_get_token(file, tok, sizeof(tok)), "%d", &width) != 1 ||
 				sscanf(netpbm_get_token(file, tok, sizeof(tok)), "%d", &height) != 1 ||
-				sscanf(netpbm_get_token(file, tok, sizeof(tok)), "%d", &levels) != 1 || levels <= 0 || levels > 255)
+				sscanf(netpbm_get_token(file, tok, sizeof(tok)), "%d", &levels) != 1 || levels <= 0 || levels > SIZEOFUSHORT)
 			{
 #ifdef VC_DEBUG
 				printf("ERROR -> vc_read_image():\n\tFile is not a valid PGM or PPM file.\n\tBad size!\n");
@@ -525,7 +1805,7 @@ IVC *vc_read_image(char *filename)
 			printf("\nchannels=%d w=%d h=%d levels=%d\n", image->channels, image->width, image->height, levels);
 #endif
 
-			size = image->width * image->height * image->channels;
+			size = image->bytesperline * image->height;
 
 			if ((v = fread(image->data, sizeof(unsigned char), size, file)) != size)
 			{
@@ -537,6 +1817,9 @@ IVC *vc_read_image(char *filename)
 				fclose(file);
 				return NULL;
 			}
+
+			if (levels > SIZEOFUCHAR)
+				netpbm_be16_to_host(image->data, size / 2);
 		}
 
 		fclose(file);
@@ -561,7 +1844,7 @@ int vc_write_image(char *filename, IVC *image)
 {
 	FILE *file = NULL;
 	unsigned char *tmp;
-	long int totalbytes, sizeofbinarydata;
+	long long totalbytes, sizeofbinarydata;
 
 	if (!image) return 0;
 
@@ -569,14 +1852,14 @@ int vc_write_image(char *filename, IVC *image)
 	{
 		if (image->levels == 1)
 		{
-			sizeofbinarydata = (image->width / 8 + ((image->width % 8) ? 1 : 0)) * image->height + 1;
+			sizeofbinarydata = (long long)(image->width / 8 + ((image->width % 8) ? 1 : 0)) * image->height + 1;
 			tmp = (unsigned char *)malloc(sizeofbinarydata);
 			if (!tmp) return 0;
 
 			fprintf(file, "%s %d %d\n", "P4", image->width, image->height);
 
 			totalbytes = unsigned_char_to_bit(image->data, tmp, image->width, image->height);
-			printf("Total = %ld\n", totalbytes);
+			printf("Total = %lld\n", totalbytes);
 			if (fwrite(tmp, sizeof(unsigned char), totalbytes, file) != totalbytes)
 			{
 #ifdef VC_DEBUG
@@ -591,9 +1874,9 @@ int vc_write_image(char *filename, IVC *image)
 		}
 		else
 		{
-			fprintf(file, "%s %d %d 255\n", (image->channels == 1) ? "P5" : "P6", image->width, image->height);
+			fprintf(file, "%s %d %d %d\n", (image->channels == 1) ? "P5" : "P6", image->width, image->height, MAX(image->levels, SIZEOFUCHAR));
 
-			if (fwrite(image->data, image->bytesperline, image->height, file) != image->height)
+			if (!netpbm_write_rows(file, image, 0, image->height))
 			{
 #ifdef VC_DEBUG
 				fprintf(stderr, "ERROR -> vc_read_image():\n\tError writing PBM, PGM or PPM file.\n");
@@ -608,3 +1891,285 @@ int vc_write_image(char *filename, IVC *image)
 
 	return 0;
 }
+
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// Image Read and Write by rows (PGM E PPM strips)
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+/**
+ * @summary: Reads a PGM or PPM header, leaving the file at the first data byte
+ * @file: Receives the opened file
+ * @channels, @width, @height, @levels: Receive the pointers to the header values
+ * @return True if success, or false if not
+*/
+int netpbm_read_header(FILE *file, int *channels, int *width, int *height, int *levels)
+{
+	char tok[20];
+
+	netpbm_get_token(file, tok, sizeof(tok));
+
+	if (strcmp(tok, "P5") == 0)
+		*channels = VC_CH_1;
+	else if (strcmp(tok, "P6") == 0)
+		*channels = VC_CH_3;
+	else
+		return 0;
+
+	if (sscanf(netpbm_get_token(file, tok, sizeof(tok)), "%d", width) != 1 ||
+		sscanf(netpbm_get_token(file, tok, sizeof(tok)), "%d", height) != 1 ||
+		sscanf(netpbm_get_token(file, tok, sizeof(tok)), "%d", levels) != 1 ||
+		*width <= MINWIDTH || *height <= MINHEIGHT || *levels <= 0 || *levels > SIZEOFUSHORT)
+		return 0;
+
+	return 1;
+}
+
+/**
+ * @summary: Read the header of a PGM or PPM image
+ * @filename: Receives the file name and extension
+ * @width, @height, @channels, @levels: Receive the pointers where the header values are stored
+ * @return True if success, or false if not
+*/
+int vc_read_image_header(char *filename, int *width, int *height, int *channels, int *levels)
+{
+	FILE *file = NULL;
+	int v;
+
+	if ((file = fopen(filename, "rb")) == NULL) return 0;
+
+	v = netpbm_read_header(file, channels, width, height, levels);
+
+	fclose(file);
+	return v;
+}
+
+/**
+ * @summary: Read the rows [ystart, yend) of a PGM or PPM image
+ * @filename: Receives the file name and extension
+ * @ystart: Receives the first row, clamped to the image
+ * @yend: Receives the row after the last one, clamped to the image
+ * @return Pointer to the struct holding only the rows read, or NULL
+*/
+IVC *vc_read_image_rows(char *filename, int ystart, int yend)
+{
+	FILE *file = NULL;
+	IVC *image = NULL;
+	long long offset, size;
+	int width, height, channels, levels;
+
+	if ((file = fopen(filename, "rb")) == NULL)
+	{
+#ifdef VC_DEBUG
+		printf("ERROR -> vc_read_image_rows():\n\tFile not found.\n");
+#endif
+		return NULL;
+	}
+
+	if (!netpbm_read_header(file, &channels, &width, &height, &levels))
+	{
+#ifdef VC_DEBUG
+		printf("ERROR -> vc_read_image_rows():\n\tFile is not a valid PGM or PPM file.\n");
+#endif
+		fclose(file);
+		return NULL;
+	}
+
+	ystart = MAX(ystart, 0);
+	yend = MIN(yend, height);
+	if (ystart >= yend)
+	{
+		fclose(file);
+		return NULL;
+	}
+
+	// Image memory alloc
+	image = vc_image_new(width, yend - ystart, channels, levels);
+	if (!image)
+	{
+		fclose(file);
+		return NULL;
+	}
+
+	offset = ftello(file) + ystart * image->bytesperline;
+	size = image->bytesperline * image->height;
+
+	if (fseeko(file, offset, SEEK_SET) != 0 || fread(image->data, sizeof(unsigned char), size, file) != size)
+	{
+#ifdef VC_DEBUG
+		printf("ERROR -> vc_read_image_rows():\n\tPremature EOF on file.\n");
+#endif
+		vc_image_free(image);
+		fclose(file);
+		return NULL;
+	}
+
+	if (levels > SIZEOFUCHAR)
+		netpbm_be16_to_host(image->data, size / 2);
+
+	fclose(file);
+
+	return image;
+}
+
+/**
+ * @summary: Writes all rows of an image at row ystart of a PGM or PPM file, creating it if needed.
+ * The file is not truncated, so several writers can fill disjoint rows of the same file.
+ * @filename: Receives the file name and extension
+ * @image: Receives the pointer to the rows in memory
+ * @height: Receives the full image height of the file
+ * @ystart: Receives the file row of the first image row
+ * @return True if success, or false if not
+*/
+int vc_write_image_rows(char *filename, IVC *image, int height, int ystart)
+{
+	FILE *file = NULL;
+	long long offset;
+
+	if (!image || image->levels == 1) return 0;
+	if ((ystart < 0) || (ystart + image->height > height)) return 0;
+
+	// Create the file without truncating it
+	if ((file = fopen(filename, "ab")) == NULL) return 0;
+	fclose(file);
+
+	if ((file = fopen(filename, "r+b")) == NULL) return 0;
+
+	// Every writer writes the same header
+	fprintf(file, "%s %d %d %d\n", (image->channels == 1) ? "P5" : "P6", image->width, height, MAX(image->levels, SIZEOFUCHAR));
+
+	offset = ftello(file) + ystart * image->bytesperline;
+
+	if (fseeko(file, offset, SEEK_SET) != 0 || !netpbm_write_rows(file, image, 0, image->height))
+	{
+#ifdef VC_DEBUG
+		fprintf(stderr, "ERROR -> vc_write_image_rows():\n\tError writing PGM or PPM file.\n");
+#endif
+		fclose(file);
+		return 0;
+	}
+
+	fclose(file);
+	return 1;
+}
+
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// Histogram Read and Write
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+/**
+ * @summary: Save a histogram as text, so it can be exchanged between hosts
+ * @filename: Receives the file name
+ * @hist: Receives the histogram
+ * @nlevels: Receives the number of histogram levels
+ * @return True if success, or false if not
+*/
+int vc_write_histogram(char *filename, long long *hist, int nlevels)
+{
+	FILE *file = NULL;
+	int i;
+
+	if ((file = fopen(filename, "w")) == NULL) return 0;
+
+	fprintf(file, "VCHIST %d\n", nlevels);
+	for (i = 0; i < nlevels; i++)
+		fprintf(file, "%lld\n", hist[i]);
+
+	if (fclose(file) != 0) return 0;
+
+	return 1;
+}
+
+/**
+ * @summary: Read a histogram saved by vc_write_histogram and add it to hist
+ * @filename: Receives the file name
+ * @hist: Receives the histogram to add to
+ * @nlevels: Receives the number of histogram levels, must match the file
+ * @return True if success, or false if not
+*/
+int vc_read_histogram(char *filename, long long *hist, int nlevels)
+{
+	FILE *file = NULL;
+	long long count;
+	int i, levels;
+
+	if ((file = fopen(filename, "r")) == NULL) return 0;
+
+	if (fscanf(file, "VCHIST %d", &levels) != 1 || levels != nlevels)
+	{
+		fclose(file);
+		return 0;
+	}
+
+	for (i = 0; i < nlevels; i++)
+	{
+		if (fscanf(file, "%lld", &count) != 1)
+		{
+			fclose(file);
+			return 0;
+		}
+		hist[i] += count;
+	}
+
+	fclose(file);
+	return 1;
+}
+
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// File hashing
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+/**
+ * @summary: Finalizer of splitmix64, every input bit reaches every output bit
+*/
+static unsigned long long vc_hash_mix(unsigned long long x)
+{
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+
+	return x ^ (x >> 31);
+}
+
+/**
+ * @summary: 64-bit hash of a file content, taken over 64-bit words to keep up with the disk. Each word
+ * is mixed before the FNV style combine, a plain multiply only carries bits upward and lets changes in
+ * the high bits of two words cancel out
+ * @filename: Receives the file name
+ * @hash: Receives the pointer where the hash is stored
+ * @return True if success, or false if not
+*/
+int vc_file_hash(char *filename, unsigned long long *hash)
+{
+	FILE *file = NULL;
+	unsigned char *buffer;
+	unsigned long long h = 14695981039346656037ULL, word;
+	size_t n, i;
+
+	if ((file = fopen(filename, "rb")) == NULL) return 0;
+
+	buffer = (unsigned char *)malloc(VC_HASHBUFFER);
+	if (!buffer)
+	{
+		fclose(file);
+		return 0;
+	}
+
+	while ((n = fread(buffer, 1, VC_HASHBUFFER, file)) > 0)
+	{
+		for (i = 0; i + 8 <= n; i += 8)
+		{
+			memcpy(&word, buffer + i, 8);
+			h = (h ^ vc_hash_mix(word)) * 1099511628211ULL;
+		}
+		for (; i < n; i++)
+			h = (h ^ vc_hash_mix(buffer[i])) * 1099511628211ULL;
+	}
+
+	// Spread the high bits of the last multiply to the low ones
+	h = vc_hash_mix(h);
+
+	free(buffer);
+	fclose(file);
+
+	*hash = h;
+	return 1;
+}
@@ -23,6 +23,52 @@
 #define GRAYLEVELS 256
 
 #define SIZEOFUCHAR 255
+#define SIZEOFUSHORT 65535
+
+// Bytes per sample, Netpbm images with more than 255 levels use 16-bit samples
+#define VC_SAMPLESIZE(levels) ((levels) > SIZEOFUCHAR ? 2 : 1)
+
+// Number of histogram levels of a gradient image
+#define VC_HISTLEVELS(levels) ((levels) > SIZEOFUCHAR ? (levels) + 1 : GRAYLEVELS)
+
+// Image data allocation (see vc_set_hugepages)
+#define VC_HUGEPAGES_NONE 0
+#define VC_HUGEPAGES_TRANSPARENT 1
+#define VC_HUGEPAGES_EXPLICIT 2
+
+#define VC_HUGEPAGESIZE (2UL * 1024 * 1024)
+#define VC_HUGEPAGEROUND(size) (((size) + VC_HUGEPAGESIZE - 1) & ~(VC_HUGEPAGESIZE - 1))
+
+// Edge operators
+#define VC_EDGE_SOBEL 1
+#define VC_EDGE_PREWITT 2
+
+// Color gradient combination of the RGB channels
+#define VC_COLOR_MAX 1
+#define VC_COLOR_DIZENZO 2
+
+// Quantized gradient directions of the non-maximum suppression, and their orientation map levels
+#define VC_DIR_0 0
+#define VC_DIR_45 1
+#define VC_DIR_90 2
+#define VC_DIR_135 3
+#define VC_ORIENTSTEP 63
+#define VC_TAN22 0.41421356
+
+// Gaussian pre-smoothing, 3x3 or 5x5 fixed point kernel
+#define VC_MAXRADIUS 2
+#define VC_SMOOTHSHIFT 8
+
+// Read buffer of vc_file_hash
+#define VC_HASHBUFFER (1024 * 1024)
+
+// Kernels of the unsmoothed gray gradient, all with the same results
+#define VC_KERNEL_DIRECT 1 // 3x3 operator with per pixel offsets
+#define VC_KERNEL_ROWS 2   // Row pointers, weight of the operator as a parameter
+#define VC_KERNEL_RUNSUM 3 // Column sums and differences computed once per column, 3 loads per pixel
+
+// Threads of a gradient pass
+#define VC_MAXTHREADS 64
 
 #include <stdio.h>
 #include <ctype.h>
@@ -38,10 +84,24 @@ typedef struct
 	unsigned char *data;
 	int width, height;
 	int channels;	  // Binary/Gray = 1; RGB = 3
-	int levels;		  // Binary = 1; Gray [1,255]; RGB [1,255]
-	int bytesperline; // width * channels
+	int levels;		  // Binary = 1; Gray [1,65535]; RGB [1,65535]
+	long long bytesperline; // width * channels * VC_SAMPLESIZE(levels)
+	int alloc;		  // Data allocation, VC_HUGEPAGES_*
 } IVC;
 
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// GRADIENT PASS EXECUTION
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+typedef struct
+{
+	int kernel;			 // VC_KERNEL_*, unsmoothed gray gradient only
+	int striprows;		 // Rows per strip of the unsmoothed gray gradient, 0 = one strip per thread
+	int threads;		 // Threads of the unsmoothed gray gradient, [1, VC_MAXTHREADS]
+	int enginestriprows; // Rows per strip of the smoothing, color and NMS passes, which prime their
+						 // row ring again at every strip
+	int enginethreads;	 // Threads of the smoothing, color and NMS passes
+} VCTUNE;
+
 //+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 // EDGE DETECTION
 //+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
@@ -63,6 +123,143 @@ int vc_gray_edge_sobel(IVC *src, IVC *dst, float th);
 */
 int vc_gray_edge_prewitt(IVC *src, IVC *dst, float th);
 
+/**
+ * @summary: Sobel gradient magnitude (no threshold). The image border is set to 0 and the magnitude saturates at the image maximum
+ * @src: Receives the source image pointer
+ * @dst: Receives the destination image pointer
+ * @return: true if the operation succeeds, false if not
+*/
+int vc_gray_gradient_sobel(IVC *src, IVC *dst);
+
+/**
+ * @summary: Prewitt gradient magnitude (no threshold). The image border is set to 0 and the magnitude saturates at the image maximum
+ * @src: Receives the source image pointer
+ * @dst: Receives the destination image pointer
+ * @return: true if the operation succeeds, false if not
+*/
+int vc_gray_gradient_prewitt(IVC *src, IVC *dst);
+
+/**
+ * @summary: Sets the first and last rows and columns of a gray image to 0
+ * @image: Receives the image pointer
+*/
+void vc_gray_clear_border(IVC *image);
+
+/**
+ * @summary: Accumulates the grey level histogram of the rows [ystart, yend), skipping the first column
+ * @src: Receives the gradient image pointer
+ * @ystart: Receives the first row
+ * @yend: Receives the row after the last one
+ * @hist: Receives the VC_HISTLEVELS(src->levels) histogram to add to
+ * @return: true if the operation succeeds, false if not
+*/
+int vc_gray_histogram(IVC *src, int ystart, int yend, long long *hist);
+
+/**
+ * @summary: Finds the threshold grey level of a histogram
+ * Threshold is defined by the intensity when we reach a desired percentage of pixels
+ * @hist: Receives the histogram
+ * @nlevels: Receives the number of histogram levels, VC_HISTLEVELS(levels)
+ * @size: Receives the number of pixels of the whole image w*h
+ * @th: receives the edging threshold [0.001, 1.00]
+ * @return: the threshold grey level
+*/
+int vc_histogram_threshold(long long *hist, int nlevels, long long size, float th);
+
+/**
+ * @summary: Binarizes the rows [ystart, yend) of a gray image in place, skipping the first column
+ * @image: Receives the image pointer
+ * @ystart: Receives the first row
+ * @yend: Receives the row after the last one
+ * @threshold: Receives the grey level threshold
+ * @return: true if the operation succeeds, false if not
+*/
+int vc_gray_binarize(IVC *image, int ystart, int yend, int threshold);
+
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// ROLLING ROW GRADIENT ENGINE
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+/**
+ * @summary: Smoothing radius used for a sigma, 3x3 below 1.0 and 5x5 from there on
+ * @sigma: Receives the Gaussian sigma, 0 disables the smoothing
+ * @return: the radius in pixels
+*/
+int vc_smooth_radius(float sigma);
+
+/**
+ * @summary: Fixed point Gaussian weights of a sigma, summing 1 << VC_SMOOTHSHIFT. The smoothing only
+ * depends on these weights
+ * @sigma: Receives the Gaussian sigma, 0 disables the smoothing
+ * @kernel: Receives the 2 * VC_MAXRADIUS + 1 weights array, the first 2 * radius + 1 are set
+ * @return: the radius in pixels
+*/
+int vc_smooth_kernel(float sigma, int *kernel);
+
+/**
+ * @summary: Sobel or Prewitt gradient magnitude of a gray image, smoothed in the same pass.
+ * The image border is set to 0 and the magnitude saturates at the image maximum
+ * @src: Receives the source image pointer
+ * @dst: Receives the destination image pointer
+ * @op: Receives VC_EDGE_SOBEL or VC_EDGE_PREWITT
+ * @sigma: Receives the Gaussian smoothing sigma, 0 = none
+ * @return: true if the operation succeeds, false if not
+*/
+int vc_gray_gradient_smooth(IVC *src, IVC *dst, int op, float sigma);
+
+/**
+ * @summary: Color gradient magnitude of a RGB image, taken from the per channel derivatives without
+ * gray conversion. The image border is set to 0 and the magnitude saturates at the image maximum
+ * @src: Receives the source RGB image pointer
+ * @dst: Receives the destination gray image pointer
+ * @op: Receives VC_EDGE_SOBEL or VC_EDGE_PREWITT
+ * @sigma: Receives the Gaussian smoothing sigma, 0 = none
+ * @mode: Receives VC_COLOR_MAX (channel with the largest gradient) or VC_COLOR_DIZENZO
+ * (square root of the largest eigenvalue of the Di Zenzo structure tensor)
+ * @return: true if the operation succeeds, false if not
+*/
+int vc_rgb_gradient(IVC *src, IVC *dst, int op, float sigma, int mode);
+
+/**
+ * @summary: Thin edges, gradient magnitude with non-maximum suppression in the same pass. Only the
+ * pixels that are a maximum across the edge keep their magnitude, the others are set to 0
+ * @src: Receives the source gray image pointer, or RGB with a color mode
+ * @dst: Receives the destination gray image pointer
+ * @orient: Receives the optional 8-bit orientation map pointer (NULL if not needed). Kept pixels
+ * are set to (direction + 1) * VC_ORIENTSTEP, direction being VC_DIR_0 to VC_DIR_135, others to 0
+ * @op: Receives VC_EDGE_SOBEL or VC_EDGE_PREWITT
+ * @sigma: Receives the Gaussian smoothing sigma, 0 = none
+ * @color: Receives VC_COLOR_MAX or VC_COLOR_DIZENZO for RGB images
+ * @return: true if the operation succeeds, false if not
+*/
+int vc_gradient_nms(IVC *src, IVC *dst, IVC *orient, int op, float sigma, int color);
+
+/**
+ * @summary: Gradient magnitude with the given operator and smoothing. Without smoothing the
+ * kernel selected by vc_set_tune() is used, all of them give the vc_gray_gradient_sobel and
+ * vc_gray_gradient_prewitt results
+ * @src: Receives the source image pointer
+ * @dst: Receives the destination image pointer
+ * @op: Receives VC_EDGE_SOBEL or VC_EDGE_PREWITT
+ * @sigma: Receives the Gaussian smoothing sigma, 0 = none
+ * @return: true if the operation succeeds, false if not
+*/
+int vc_gray_gradient(IVC *src, IVC *dst, int op, float sigma);
+
+/**
+ * @summary: Selects the kernel, strip height and thread count of the gradient passes, the unsmoothed
+ * gray kernels and the row engine (smoothing, color, NMS) being tuned apart. The default is
+ * VC_KERNEL_DIRECT, a single strip and a single thread for both
+ * @tune: Receives the configuration, usually found by the edge --autotune benchmark
+*/
+void vc_set_tune(VCTUNE *tune);
+
+/**
+ * @summary: Current kernel, strip height and thread count of the gradient passes
+ * @tune: Receives the pointer where the configuration is stored
+*/
+void vc_get_tune(VCTUNE *tune);
+
 //+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 // Image Convertion
 //+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
@@ -89,6 +286,13 @@ int vc_rgb_to_gray(IVC *src, IVC *dst);
 */
 IVC *vc_image_new(int width, int height, int channels, int levels);
 
+/**
+ * @summary: Selects how large image buffers are backed
+ * @mode: VC_HUGEPAGES_NONE, VC_HUGEPAGES_TRANSPARENT (madvise) or VC_HUGEPAGES_EXPLICIT (MAP_HUGETLB,
+ * falling back to transparent huge pages when the pool is empty)
+*/
+void vc_set_hugepages(int mode);
+
 /**
  * @summary: Image memory free
  * @image: Receives the image pointer
@@ -114,3 +318,70 @@ IVC *vc_read_image(char *filename);
  * @return True if success, or false if not
 */
 int vc_write_image(char *filename, IVC *image);
+
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// Image Read and Write by rows (PGM E PPM strips)
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+/**
+ * @summary: Read the header of a PGM or PPM image
+ * @filename: Receives the file name and extension
+ * @width, @height, @channels, @levels: Receive the pointers where the header values are stored
+ * @return True if success, or false if not
+*/
+int vc_read_image_header(char *filename, int *width, int *height, int *channels, int *levels);
+
+/**
+ * @summary: Read the rows [ystart, yend) of a PGM or PPM image
+ * @filename: Receives the file name and extension
+ * @ystart: Receives the first row, clamped to the image
+ * @yend: Receives the row after the last one, clamped to the image
+ * @return Pointer to the struct holding only the rows read, or NULL
+*/
+IVC *vc_read_image_rows(char *filename, int ystart, int yend);
+
+/**
+ * @summary: Writes all rows of an image at row ystart of a PGM or PPM file, creating it if needed.
+ * The file is not truncated, so several writers can fill disjoint rows of the same file.
+ * @filename: Receives the file name and extension
+ * @image: Receives the pointer to the rows in memory
+ * @height: Receives the full image height of the file
+ * @ystart: Receives the file row of the first image row
+ * @return True if success, or false if not
+*/
+int vc_write_image_rows(char *filename, IVC *image, int height, int ystart);
+
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// Histogram Read and Write
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+/**
+ * @summary: Save a histogram as text, so it can be exchanged between hosts
+ * @filename: Receives the file name
+ * @hist: Receives the histogram
+ * @nlevels: Receives the number of histogram levels
+ * @return True if success, or false if not
+*/
+int vc_write_histogram(char *filename, long long *hist, int nlevels);
+
+/**
+ * @summary: Read a histogram saved by vc_write_histogram and add it to hist
+ * @filename: Receives the file name
+ * @hist: Receives the histogram to add to
+ * @nlevels: Receives the number of histogram levels, must match the file
+ * @return True if success, or false if not
+*/
+int vc_read_histogram(char *filename, long long *hist, int nlevels);
+
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// File hashing
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+/**
+ * @summary: 64-bit hash of a file content, taken over 64-bit words to keep up with the disk.
+ * Each word goes through the splitmix64 finalizer before a FNV style combine
+ * @filename: Receives the file name
+ * @hash: Receives the pointer where the hash is stored
+ * @return True if success, or false if not
+*/
+int vc_file_hash(char *filename, unsigned long long *hash);
@@ -8,110 +8,878 @@
  * @version 0.1.2
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <malloc.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 #include "cvision.h"
 
+#define FILENAMELEN 1024
+
+/**
+ * Gradient options of the edge pipeline
+*/
+typedef struct
+{
+    int op;      // VC_EDGE_SOBEL or VC_EDGE_PREWITT
+    float sigma; // Gaussian pre-smoothing, 0 = none
+    int color;   // VC_COLOR_MAX or VC_COLOR_DIZENZO for RGB images, 0 = gray conversion
+    int nms;     // Non-maximum suppression, thin edges
+} EDGEOPTIONS;
+
+/**
+ * @summary: Gradient magnitude of a gray or RGB image. RGB images are converted to gray first,
+ * unless a color gradient is selected
+ * @orient: Receives the orientation map pointer of the non-maximum suppression, or NULL
+ * @return true if the operation succeeds, false if not
+*/
+static int edge_gradient(IVC *image, IVC *grad, IVC *orient, EDGEOPTIONS *options)
+{
+    IVC *gray = NULL;
+    int ok;
+
+    if (image->channels == VC_CH_1 || options->color)
+    {
+        if (options->nms)
+            return vc_gradient_nms(image, grad, orient, options->op, options->sigma, options->color);
+        if (image->channels == VC_CH_1)
+            return vc_gray_gradient(image, grad, options->op, options->sigma);
+
+        return vc_rgb_gradient(image, grad, options->op, options->sigma, options->color);
+    }
+
+    gray = vc_image_new(image->width, image->height, 1, image->levels);
+    ok = gray && vc_rgb_to_gray(image, gray) && edge_gradient(gray, grad, orient, options);
+    vc_image_free(gray);
+
+    return ok;
+}
+
+/**
+ * @summary: Threshold grey level of a gradient histogram. Pixels removed by the non-maximum
+ * suppression never become edges
+*/
+static int edge_threshold(long long *hist, int levels, long long size, float th, EDGEOPTIONS *options)
+{
+    int threshold = vc_histogram_threshold(hist, VC_HISTLEVELS(levels), size, th);
+
+    return options->nms ? MAX(threshold, 1) : threshold;
+}
+
+/**
+ * Sharded edging
+ * The image is split in strips of rows, one per worker. In phase 1 each worker reads its strip plus
+ * halo rows above and below from the source file (one, plus the smoothing radius, plus one for the
+ * non-maximum suppression), writes the gradient
+ * magnitude to its rows of the shared output file and saves a partial histogram. In phase 2 each worker
+ * merges all partial histograms, finds the global threshold and binarizes its own rows of the output
+ * file in place.
+ * Workers only share files, so the phases can also be run on several hosts over a shared folder.
+*/
+
+/**
+ * @summary: Rows [ystart, yend) of a shard
+*/
+static void shard_rows(int shard, int nshards, int height, int *ystart, int *yend)
+{
+    *ystart = (int)((long long)height * shard / nshards);
+    *yend = (int)((long long)height * (shard + 1) / nshards);
+}
+
+/**
+ * @summary: Partial histogram file name of a shard
+*/
+static void shard_histname(char *output, int shard, char *name)
+{
+    snprintf(name, FILENAMELEN, "%s.%d.hist", output, shard);
+}
+
+/**
+ * @summary: Phase 1, gradient and partial histogram of a shard
+ * @return true if the operation succeeds, false if not
+*/
+static int shard_gradient(char *input, char *output, EDGEOPTIONS *options, int shard, int nshards)
+{
+    IVC *strip = NULL, *grad = NULL, view;
+    char histname[FILENAMELEN];
+    long long *hist = NULL;
+    int width, height, channels, levels, ystart, yend, ok;
+    int halo = 1 + vc_smooth_radius(options->sigma) + (options->nms ? 1 : 0);
+
+    if (!vc_read_image_header(input, &width, &height, &channels, &levels))
+        return 0;
+
+    shard_histname(output, shard, histname);
+    shard_rows(shard, nshards, height, &ystart, &yend);
+
+    // More shards than rows
+    if (ystart >= yend)
+    {
+        hist = (long long *)calloc(VC_HISTLEVELS(levels), sizeof(long long));
+        ok = hist && vc_write_histogram(histname, hist, VC_HISTLEVELS(levels));
+        free(hist);
+        return ok;
+    }
+
+    // Read the strip with its halo rows
+    strip = vc_read_image_rows(input, ystart - halo, yend + halo);
+    if (!strip)
+        return 0;
+
+    grad = vc_image_new(width, strip->height, 1, levels);
+    hist = (long long *)calloc(VC_HISTLEVELS(levels), sizeof(long long));
+    ok = grad && hist && edge_gradient(strip, grad, NULL, options);
+
+    if (ok)
+    {
+        // Drop the halo rows
+        view = *grad;
+        view.data += (ystart - MAX(ystart - halo, 0)) * grad->bytesperline;
+        view.height = yend - ystart;
+
+        // The first image row is not part of the histogram
+        ok = vc_gray_histogram(&view, ystart == 0 ? 1 : 0, view.height, hist) &&
+             vc_write_histogram(histname, hist, VC_HISTLEVELS(levels)) &&
+             vc_write_image_rows(output, &view, height, ystart);
+    }
+
+    vc_image_free(strip);
+    vc_image_free(grad);
+    free(hist);
+
+    return ok;
+}
+
+/**
+ * @summary: Phase 2, merge the partial histograms and binarize the rows of a shard in place
+ * @return true if the operation succeeds, false if not
+*/
+static int shard_threshold(char *output, EDGEOPTIONS *options, float th, int shard, int nshards)
+{
+    IVC *strip = NULL;
+    char histname[FILENAMELEN];
+    long long *hist = NULL;
+    int width, height, channels, levels, ystart, yend, i, ok;
+
+    if (!vc_read_image_header(output, &width, &height, &channels, &levels))
+        return 0;
+
+    hist = (long long *)calloc(VC_HISTLEVELS(levels), sizeof(long long));
+    if (!hist)
+        return 0;
+
+    for (i = 0; i < nshards; i++)
+    {
+        shard_histname(output, i, histname);
+        if (!vc_read_histogram(histname, hist, VC_HISTLEVELS(levels)))
+        {
+            free(hist);
+            return 0;
+        }
+    }
+
+    shard_rows(shard, nshards, height, &ystart, &yend);
+    strip = vc_read_image_rows(output, ystart, yend);
+
+    ok = (ystart >= yend) ||
+         (strip && vc_gray_binarize(strip, ystart == 0 ? 1 : 0, strip->height, edge_threshold(hist, levels, (long long)width * height, th, options)) &&
+          vc_write_image_rows(output, strip, height, ystart));
+
+    vc_image_free(strip);
+    free(hist);
+
+    return ok;
+}
+
+/**
+ * @summary: Runs both phases with one local worker process per shard
+ * @return true if the operation succeeds, false if not
+*/
+static int shard_run(char *input, char *output, EDGEOPTIONS *options, float th, int nshards)
+{
+    char histname[FILENAMELEN];
+    int phase, i, status, ok = 1;
+    pid_t pid;
+
+    // Workers never truncate the output file
+    remove(output);
+    fflush(stdout);
+
+    for (phase = 1; phase <= 2 && ok; phase++)
+    {
+        for (i = 0; i < nshards; i++)
+        {
+            pid = fork();
+            if (pid == 0)
+            {
+                if (phase == 1)
+                    _exit(shard_gradient(input, output, options, i, nshards) ? 0 : 1);
+                else
+                    _exit(shard_threshold(output, options, th, i, nshards) ? 0 : 1);
+            }
+            if (pid < 0)
+                ok = 0;
+        }
+
+        // Wait for every worker of the phase
+        while (wait(&status) > 0)
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                ok = 0;
+    }
+
+    for (i = 0; i < nshards; i++)
+    {
+        shard_histname(output, i, histname);
+        remove(histname);
+    }
+
+    return ok;
+}
+
+#define MAXTHRESHOLDS 32
+#define THRESHOLD_NAMELEN 32
+
+/**
+ * Threshold sweep
+ * Only the binarization depends on the threshold, so several thresholds share one gradient and
+ * histogram. With more than one threshold, each output name gets the threshold before its extension.
+*/
+
+/**
+ * @summary: Parses a comma separated threshold list, keeping the text of each one for the output names
+ * @return the number of thresholds, or 0 if any of them is out of [0.001, 1.00]
+*/
+static int threshold_parse(const char *list, float *thresholds, char names[][THRESHOLD_NAMELEN])
+{
+    int n = 0, len;
+
+    while (*list && n < MAXTHRESHOLDS)
+    {
+        len = (int)strcspn(list, ",");
+        if (len == 0 || len >= THRESHOLD_NAMELEN)
+            return 0;
+
+        memcpy(names[n], list, len);
+        names[n][len] = 0;
+        thresholds[n] = atof(names[n]);
+        if (thresholds[n] <= 0.0f || thresholds[n] > 1.0f)
+            return 0;
+
+        n++;
+        list += len;
+        if (*list == ',')
+            list++;
+    }
+
+    return *list ? 0 : n;
+}
+
+/**
+ * @summary: Output name of a threshold, "out.pgm" becomes "out_0.5.pgm"
+*/
+static void threshold_outname(const char *output, const char *threshold, char *name)
+{
+    const char *dot = strrchr(output, '.');
+    const char *slash = strrchr(output, '/');
+
+    if (!dot || (slash && slash > dot))
+        dot = output + strlen(output);
+
+    snprintf(name, FILENAMELEN, "%.*s_%s%s", (int)(dot - output), output, threshold, dot);
+}
+
+/**
+ * Gradient cache
+ * The gradient magnitude and its histogram are saved as sidecar files named after the input content
+ * hash and the operator, so later runs on the same image only apply the threshold.
+*/
+
+/**
+ * @summary: Sidecar file names of the gradient image and its histogram
+*/
+static void cache_names(const char *dir, unsigned long long hash, const char *key, char *gradname, char *histname)
+{
+    snprintf(gradname, FILENAMELEN, "%s/%016llx.%s.grad.pgm", dir, hash, key);
+    snprintf(histname, FILENAMELEN, "%s/%016llx.%s.hist", dir, hash, key);
+}
+
+/**
+ * @summary: Loads a cached gradient and its histogram
+ * @return the gradient image, or NULL on a cache miss
+*/
+static IVC *cache_load(const char *gradname, const char *histname, long long **hist)
+{
+    FILE *file = NULL;
+    IVC *grad = NULL;
+
+    // Avoid the read error messages on a miss
+    if ((file = fopen(gradname, "rb")) == NULL)
+        return NULL;
+    fclose(file);
+
+    grad = vc_read_image((char *)gradname);
+    if (!grad)
+        return NULL;
+
+    *hist = (long long *)calloc(VC_HISTLEVELS(grad->levels), sizeof(long long));
+    if (!*hist || !vc_read_histogram((char *)histname, *hist, VC_HISTLEVELS(grad->levels)))
+    {
+        free(*hist);
+        *hist = NULL;
+        return vc_image_free(grad);
+    }
+
+    return grad;
+}
+
+/**
+ * @summary: Temporary name next to a file, unique to this host and process so that concurrent
+ * writers, also on other hosts sharing the folder, never write the same temporary file
+*/
+static void temp_name(const char *name, char *tmpname)
+{
+    char host[256];
+
+    if (gethostname(host, sizeof(host)) != 0)
+        snprintf(host, sizeof(host), "localhost");
+    host[sizeof(host) - 1] = '\0';
+
+    snprintf(tmpname, FILENAMELEN, "%s.%s.%ld.tmp", name, host, (long)getpid());
+}
+
+/**
+ * @summary: Saves a gradient and its histogram. Each process writes its own temporary files and renames
+ * them into place, so concurrent runs never read partial files
+ * @return true if the operation succeeds, false if not
+*/
+static int cache_save(const char *gradname, const char *histname, IVC *grad, long long *hist)
+{
+    char tmpname[FILENAMELEN];
+    int ok;
+
+    temp_name(histname, tmpname);
+    ok = vc_write_histogram(tmpname, hist, VC_HISTLEVELS(grad->levels)) && rename(tmpname, histname) == 0;
+    if (!ok)
+        remove(tmpname);
+
+    temp_name(gradname, tmpname);
+    ok = ok && vc_write_image(tmpname, grad) && rename(tmpname, gradname) == 0;
+    if (!ok)
+        remove(tmpname);
+
+    return ok;
+}
+
+#define TUNE_WIDTH 2048
+#define TUNE_HEIGHT 2048
+#define TUNE_REPEATS 3
+#define TUNE_HOSTLEN 256
+#define TUNE_SIGMA 1.5f
+
+/**
+ * Autotuning
+ * edge --autotune times every kernel, strip height and thread count of the unsmoothed gray pass, then
+ * every strip height and thread count of a smoothed row engine pass, on a synthetic image. The fastest
+ * ones go to ~/.edge_tune, one line per machine:
+ * "host cpus kernel striprows threads enginestriprows enginethreads".
+ * Normal runs load the line of their machine, so a home folder shared across hosts works too.
+*/
+
+/**
+ * @summary: Tune file name and the host name and CPU count that identify this machine
+*/
+static void tune_machine(char *filename, char *host, int *cpus)
+{
+    const char *home = getenv("HOME");
+
+    snprintf(filename, FILENAMELEN, "%s/.edge_tune", home ? home : ".");
+
+    if (gethostname(host, TUNE_HOSTLEN) != 0)
+        snprintf(host, TUNE_HOSTLEN, "localhost");
+    host[TUNE_HOSTLEN - 1] = '\0';
+
+    *cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    *cpus = MAX(*cpus, 1);
+}
+
+/**
+ * @summary: Loads the configuration of this machine from the tune file and selects it
+ * @return true if the machine has a configuration, false if not
+*/
+static int tune_load(VCTUNE *tune)
+{
+    char filename[FILENAMELEN], host[TUNE_HOSTLEN], line[FILENAMELEN], name[TUNE_HOSTLEN];
+    FILE *file = NULL;
+    int cpus, n, found = 0;
+
+    tune_machine(filename, host, &cpus);
+    if ((file = fopen(filename, "r")) == NULL)
+        return 0;
+
+    while (!found && fgets(line, FILENAMELEN, file))
+        if (sscanf(line, "%255s %d %d %d %d %d %d", name, &n, &tune->kernel, &tune->striprows, &tune->threads, &tune->enginestriprows, &tune->enginethreads) == 7)
+            found = (strcmp(name, host) == 0) && (n == cpus);
+    fclose(file);
+
+    if (found)
+        vc_set_tune(tune);
+
+    return found;
+}
+
+/**
+ * @summary: Saves the configuration of this machine, keeping the lines of the other machines
+ * @return true if the operation succeeds, false if not
+*/
+static int tune_save(VCTUNE *tune)
+{
+    char filename[FILENAMELEN], tmpname[FILENAMELEN], host[TUNE_HOSTLEN], line[FILENAMELEN], name[TUNE_HOSTLEN];
+    FILE *file = NULL, *tmp = NULL;
+    int cpus;
+
+    tune_machine(filename, host, &cpus);
+    temp_name(filename, tmpname);
+    if ((tmp = fopen(tmpname, "w")) == NULL)
+        return 0;
+
+    if ((file = fopen(filename, "r")) != NULL)
+    {
+        while (fgets(line, FILENAMELEN, file))
+            if (sscanf(line, "%255s", name) == 1 && strcmp(name, host) != 0)
+                fputs(line, tmp);
+        fclose(file);
+    }
+    fprintf(tmp, "%s %d %d %d %d %d %d\n", host, cpus, tune->kernel, tune->striprows, tune->threads, tune->enginestriprows, tune->enginethreads);
+
+    if ((fclose(tmp) == 0) && (rename(tmpname, filename) == 0))
+        return 1;
+
+    remove(tmpname);
+    return 0;
+}
+
+/**
+ * @summary: Best of TUNE_REPEATS Sobel passes over the synthetic image, in seconds
+ * @sigma: Receives 0 for the unsmoothed gray kernels, or the smoothing of a row engine pass
+*/
+static double tune_time(IVC *image, IVC *grad, VCTUNE *tune, float sigma)
+{
+    struct timespec start, end;
+    double best = -1.0, t;
+    int i;
+
+    vc_set_tune(tune);
+    for (i = 0; i < TUNE_REPEATS; i++)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        vc_gray_gradient(image, grad, VC_EDGE_SOBEL, sigma);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        t = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+        if (best < 0.0 || t < best)
+            best = t;
+    }
+
+    return best;
+}
+
+/**
+ * @summary: Times every kernel, strip height and thread count up to the CPU count and saves the fastest.
+ * The row engine is timed apart with a 5x5 smoothing, the heaviest ring priming at each strip
+ * @return true if the operation succeeds, false if not
+*/
+static int tune_run(void)
+{
+    static const int striprows[] = {0, 16, 64, 256};
+    char filename[FILENAMELEN], host[TUNE_HOSTLEN];
+    IVC *image = NULL, *grad = NULL;
+    VCTUNE tune = {VC_KERNEL_DIRECT, 0, 1, 0, 1}, best = {VC_KERNEL_DIRECT, 0, 1, 0, 1};
+    double t, besttime = -1.0, enginetime = -1.0;
+    unsigned int seed = 12345;
+    long long i;
+    int cpus, s;
+
+    tune_machine(filename, host, &cpus);
+
+    image = vc_image_new(TUNE_WIDTH, TUNE_HEIGHT, 1, SIZEOFUCHAR);
+    grad = vc_image_new(TUNE_WIDTH, TUNE_HEIGHT, 1, SIZEOFUCHAR);
+    if (!image || !grad)
+    {
+        vc_image_free(image);
+        vc_image_free(grad);
+        return 0;
+    }
+
+    // Noisy diagonal ramp, so every kernel does the same work as on a photo
+    for (i = 0; i < (long long)TUNE_WIDTH * TUNE_HEIGHT; i++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        image->data[i] = (unsigned char)((i % TUNE_WIDTH + i / TUNE_WIDTH) / 16 + (seed >> 27));
+    }
+
+    printf(">> Autotuning on %s, %d CPUs.\n", host, cpus);
+    for (tune.kernel = VC_KERNEL_DIRECT; tune.kernel <= VC_KERNEL_RUNSUM; tune.kernel++)
+        for (s = 0; s < (int)(sizeof(striprows) / sizeof(striprows[0])); s++)
+            for (tune.threads = 1; tune.threads <= MIN(cpus, VC_MAXTHREADS); tune.threads = (tune.threads * 2 > cpus && tune.threads < cpus) ? cpus : tune.threads * 2)
+            {
+                tune.striprows = striprows[s];
+                t = tune_time(image, grad, &tune, 0.0f);
+                printf(">> kernel %d, strip rows %d, threads %d: %.2f ms\n", tune.kernel, tune.striprows, tune.threads, t * 1000.0);
+
+                if (besttime < 0.0 || t < besttime)
+                {
+                    besttime = t;
+                    best.kernel = tune.kernel;
+                    best.striprows = tune.striprows;
+                    best.threads = tune.threads;
+                }
+            }
+
+    // Row engine passes, the kernel path keeps its defaults meanwhile
+    tune.kernel = VC_KERNEL_DIRECT;
+    tune.striprows = 0;
+    tune.threads = 1;
+    for (s = 0; s < (int)(sizeof(striprows) / sizeof(striprows[0])); s++)
+        for (tune.enginethreads = 1; tune.enginethreads <= MIN(cpus, VC_MAXTHREADS); tune.enginethreads = (tune.enginethreads * 2 > cpus && tune.enginethreads < cpus) ? cpus : tune.enginethreads * 2)
+        {
+            tune.enginestriprows = striprows[s];
+            t = tune_time(image, grad, &tune, TUNE_SIGMA);
+            printf(">> engine strip rows %d, threads %d: %.2f ms\n", tune.enginestriprows, tune.enginethreads, t * 1000.0);
+
+            if (enginetime < 0.0 || t < enginetime)
+            {
+                enginetime = t;
+                best.enginestriprows = tune.enginestriprows;
+                best.enginethreads = tune.enginethreads;
+            }
+        }
+
+    vc_image_free(image);
+    vc_image_free(grad);
+
+    printf(">> Best: kernel %d, strip rows %d, threads %d (%.2f ms); engine strip rows %d, threads %d (%.2f ms).\n", best.kernel, best.striprows, best.threads, besttime * 1000.0, best.enginestriprows, best.enginethreads, enginetime * 1000.0);
+    vc_set_tune(&best);
+
+    return tune_save(&best);
+}
+
 /**
  * Sobel and Prewitt edging methods
 */
 int main(int argc, char const *argv[])
 {
+    VCTUNE tune;
+
+    // Benchmark this machine and save its configuration
+    if (argc == 2 && strcmp(argv[1], "--autotune") == 0)
+    {
+        if (!tune_run())
+        {
+            fprintf(stderr, ">> Error! Autotune configuration not saved.\n");
+            exit(1);
+        }
+        puts(">> Autotune configuration saved.");
+        return 0;
+    }
+
     // Verify argument insertion
     if (!argv[1] || !argv[2] || !argv[3] || !argv[4])
     {
-        fprintf(stderr, "Error! Wrong argument specification.    ./program @inputname @outputname @edge_detection @threshold[0.001, 1.00]");
+        fprintf(stderr, "Error! Wrong argument specification.    ./program @inputname @outputname @edge_detection @threshold[0.001, 1.00] | ./program --autotune");
         getchar();
         exit(1);
     }
 
-    // Convert string to float
-    float threshold = atof(argv[4]);
+    // Configuration of this machine saved by --autotune
+    if (tune_load(&tune))
+        printf(">> Autotune: kernel %d, strip rows %d, threads %d; engine strip rows %d, threads %d.\n", tune.kernel, tune.striprows, tune.threads, tune.enginestriprows, tune.enginethreads);
+
+#pragma region Optional arguments
+    /**
+     * --threshold LIST         Comma separated thresholds, replaces @threshold
+     * --cache DIR              Keep the gradient and its histogram as sidecar files in DIR
+     * --smooth SIGMA           Gaussian pre-smoothing fused in the gradient pass, SIGMA in (0, 2]
+     * --color MODE             Color gradient of RGB images without gray conversion, MODE is "max" or "dizenzo"
+     * --nms                    Thin edges, non-maximum suppression in the gradient pass
+     * --orientation FILE       With --nms, save the quantized gradient orientation of the thin edges
+     * --shards N               Run N local worker processes
+     * --shard I/N              Run only worker I of N, for the phase given by --phase (1 or 2)
+     * --hugepages MODE         Back large images with huge pages, MODE is "thp" or "explicit"
+     */
+    const char *thresholdlist = argv[4], *cachedir = NULL, *orientname = NULL;
+    int i, nshards = 0, shard = -1, phase = 0, single = 0;
+    EDGEOPTIONS options = {0, 0.0f, 0, 0};
+
+    for (i = 5; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc)
+            thresholdlist = argv[++i];
+        else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+            cachedir = argv[++i];
+        else if (strcmp(argv[i], "--smooth") == 0 && i + 1 < argc)
+        {
+            options.sigma = atof(argv[++i]);
+            if (options.sigma <= 0.0f || options.sigma > 2.0f)
+            {
+                fprintf(stderr, "Error! Wrong smoothing value. --smooth SIGMA(0, 2]");
+                getchar();
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "--color") == 0 && i + 1 < argc && strcmp(argv[i + 1], "max") == 0)
+        {
+            options.color = VC_COLOR_MAX;
+            i++;
+        }
+        else if (strcmp(argv[i], "--color") == 0 && i + 1 < argc && strcmp(argv[i + 1], "dizenzo") == 0)
+        {
+            options.color = VC_COLOR_DIZENZO;
+            i++;
+        }
+        else if (strcmp(argv[i], "--nms") == 0)
+            options.nms = 1;
+        else if (strcmp(argv[i], "--orientation") == 0 && i + 1 < argc)
+            orientname = argv[++i];
+        else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc)
+            nshards = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--shard") == 0 && i + 1 < argc)
+        {
+            single = 1;
+            if (sscanf(argv[++i], "%d/%d", &shard, &nshards) != 2)
+                nshards = 0;
+        }
+        else if (strcmp(argv[i], "--phase") == 0 && i + 1 < argc)
+            phase = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--hugepages") == 0 && i + 1 < argc && strcmp(argv[i + 1], "thp") == 0)
+        {
+            vc_set_hugepages(VC_HUGEPAGES_TRANSPARENT);
+            i++;
+        }
+        else if (strcmp(argv[i], "--hugepages") == 0 && i + 1 < argc && strcmp(argv[i + 1], "explicit") == 0)
+        {
+            vc_set_hugepages(VC_HUGEPAGES_EXPLICIT);
+            i++;
+        }
+        else
+        {
+            fprintf(stderr, "Error! Unknown option %s.    --threshold LIST | --cache DIR | --smooth SIGMA(0, 2] | --color [max, dizenzo] | --nms | --orientation FILE | --shards N | --shard I/N --phase [1, 2] | --hugepages [thp, explicit]", argv[i]);
+            getchar();
+            exit(1);
+        }
+    }
+#pragma endregion
+
+#pragma region Threshold and edge method
+    float thresholds[MAXTHRESHOLDS];
+    char thresholdnames[MAXTHRESHOLDS][THRESHOLD_NAMELEN];
+    int nthresholds = threshold_parse(thresholdlist, thresholds, thresholdnames);
 
     // Verify argument insertion
-    if (threshold <= 0.0f || threshold > 1.0f)
+    if (nthresholds == 0)
     {
-        fprintf(stderr, "Error! Wrong threshold value. @threshold[0.001, 1.00]");
+        fprintf(stderr, "Error! Wrong threshold value. @threshold[0.001, 1.00], several thresholds are separated by commas");
         getchar();
         exit(1);
     }
 
-#pragma region Memory allocation and image reading
-    /** 
-     * Initialization
-     */
-    IVC *origin = NULL, *destination = NULL, *aux = NULL;
-
-    // Read image
-    origin = vc_read_image(argv[1]);
-
-    // Create destination and aux images
-    destination = vc_image_new(origin->width, origin->height, 1, origin->levels);
-    aux = vc_image_new(origin->width, origin->height, 1, origin->levels);
+    const char *methodname = NULL;
+    char cachekey[FILENAMELEN];
 
-    // Check memory alloc
-    if (!origin || !destination || !aux)
+    if (strcmp(argv[3], "sobel") == 0)
     {
-        fprintf(stderr, "Memory alloc error!\nPress any key...");
+        options.op = VC_EDGE_SOBEL;
+        methodname = "Sobel";
+    }
+    else if (strcmp(argv[3], "prewitt") == 0)
+    {
+        options.op = VC_EDGE_PREWITT;
+        methodname = "Prewitt";
+    }
+    else
+    {
+        fprintf(stderr, ">> Error! Wrong edge method. Please input \"sobel\" or \"prewitt\" on the @edge_detection specification.\n./program @inputname @outputname @edge_detection @threshold[0.001, 1.00]\nPress any key...");
         getchar();
         exit(1);
     }
-#pragma endregion
 
-#pragma region Black and White
-    if (origin->channels != 1 && vc_rgb_to_gray(origin, aux)  == 1)
-        puts(">> Image converted to grayscale.");
-    else if (origin->channels == 1)
-        memcpy(aux, origin, origin->bytesperline * origin->height);
-    else
+    if (orientname && !options.nms)
     {
-        fprintf(stderr, ">> Error! Image was not converted to grayscale.\nPress any key...");
+        fprintf(stderr, "Error! The orientation map needs --nms.");
         getchar();
         exit(1);
     }
+
+    // Cached gradients depend on the operator, the smoothing weights (not the rounded sigma), the
+    // color mode and the suppression
+    int kernel[2 * VC_MAXRADIUS + 1], radius = vc_smooth_kernel(options.sigma, kernel), len;
+
+    len = snprintf(cachekey, FILENAMELEN, "%s-s", argv[3]);
+    for (i = 0; i < 2 * radius + 1; i++)
+        len += snprintf(cachekey + len, FILENAMELEN - len, "%s%d", i ? "_" : "", kernel[i]);
+    snprintf(cachekey + len, FILENAMELEN - len, "-c%d%s", options.color, options.nms ? "-nms" : "");
 #pragma endregion
 
-#pragma region Sobel or Prewitt edging
-    if (strcmp(argv[3], "sobel")  == 0)
+#pragma region Sharded edging
+    if (nshards > 0 || single)
     {
-        if (vc_gray_edge_sobel(aux, destination, threshold) == 1)
-            puts(">> Sobel edge applied.");
+        if (nshards <= 0 || nthresholds != 1 || cachedir || orientname || (single && (shard < 0 || shard >= nshards || (phase != 1 && phase != 2))))
+        {
+            fprintf(stderr, ">> Error! Wrong sharding specification, sharding takes a single threshold, no cache and no orientation map.\n./program @inputname @outputname @edge_detection @threshold[0.001, 1.00] --shards N | --shard I/N --phase [1, 2]\n");
+            exit(1);
+        }
+
+        // Single worker, used by an external scheduler
+        if (single)
+        {
+            if (phase == 1 && shard_gradient((char *)argv[1], (char *)argv[2], &options, shard, nshards))
+                printf(">> Shard %d/%d gradient computed.\n", shard, nshards);
+            else if (phase == 2 && shard_threshold((char *)argv[2], &options, thresholds[0], shard, nshards))
+                printf(">> Shard %d/%d threshold applied.\n", shard, nshards);
+            else
+            {
+                fprintf(stderr, ">> Error! Shard %d/%d phase %d failed.\n", shard, nshards, phase);
+                exit(1);
+            }
+            return 0;
+        }
+
+        if (shard_run((char *)argv[1], (char *)argv[2], &options, thresholds[0], nshards))
+            printf(">> %s edge applied with %d shards.\n>> Image saved.\n", methodname, nshards);
         else
         {
-            fprintf(stderr, ">> Error! Sobel edge not applied.\nPress any key...");
+            fprintf(stderr, ">> Error! Sharded edge not applied.\nPress any key...");
             getchar();
             exit(1);
         }
+
+        printf("Press any key to exit...");
+        getchar();
+
+        return 0;
     }
-    else if (strcmp(argv[3], "prewitt") == 0)
+#pragma endregion
+
+#pragma region Gradient cache lookup
+    /** 
+     * Initialization
+     */
+    IVC *origin = NULL, *destination = NULL, *grad = NULL, *orient = NULL;
+    long long *hist = NULL;
+    char gradname[FILENAMELEN], histname[FILENAMELEN], outname[FILENAMELEN];
+    unsigned long long hash = 0;
+
+    // The orientation map is not cached
+    if (cachedir && !orientname)
     {
-        if (vc_gray_edge_prewitt(aux, destination, threshold) == 1)
-            puts(">> Prewitt edge applied.");
+        if (!vc_file_hash((char *)argv[1], &hash))
+        {
+            fprintf(stderr, ">> Error! Image not found.\nPress any key...");
+            getchar();
+            exit(1);
+        }
+
+        cache_names(cachedir, hash, cachekey, gradname, histname);
+        grad = cache_load(gradname, histname, &hist);
+        if (grad)
+            printf(">> %s gradient loaded from cache.\n", methodname);
+    }
+#pragma endregion
+
+    if (!grad)
+    {
+#pragma region Memory allocation and image reading
+        // Read image
+        origin = vc_read_image((char *)argv[1]);
+
+        // Create the gradient image
+        if (origin)
+        {
+            grad = vc_image_new(origin->width, origin->height, 1, origin->levels);
+            hist = (long long *)calloc(VC_HISTLEVELS(origin->levels), sizeof(long long));
+            if (orientname)
+                orient = vc_image_new(origin->width, origin->height, 1, SIZEOFUCHAR);
+        }
+
+        // Check memory alloc
+        if (!origin || !grad || !hist || (orientname && !orient))
+        {
+            fprintf(stderr, "Memory alloc error!\nPress any key...");
+            getchar();
+            exit(1);
+        }
+#pragma endregion
+
+#pragma region Sobel or Prewitt gradient
+        // RGB images are converted to grayscale unless a color gradient is selected
+        if (edge_gradient(origin, grad, orient, &options) == 1 && vc_gray_histogram(grad, 1, grad->height, hist) == 1)
+            printf(">> %s %s%sedge applied.\n", methodname, (origin->channels != 1 && options.color) ? "color " : "", options.nms ? "thin " : "");
         else
         {
-            fprintf(stderr, ">> Error! Prewitt edge not applied.\nPress any key...");
+            fprintf(stderr, ">> Error! %s edge not applied.\nPress any key...", methodname);
+            getchar();
+            exit(1);
+        }
+
+        if (orient && vc_write_image((char *)orientname, orient) == 1)
+            puts(">> Orientation map saved.");
+        else if (orient)
+        {
+            fprintf(stderr, ">> Error! Orientation map not saved!\nPress any key...");
             getchar();
             exit(1);
         }
+        vc_image_free(orient);
+
+        if (cachedir && !orientname && cache_save(gradname, histname, grad, hist))
+            puts(">> Gradient saved to cache.");
+        else if (cachedir && !orientname)
+            fprintf(stderr, ">> Warning! Gradient not saved to cache.\n");
+
+        vc_image_free(origin);
+#pragma endregion
     }
+
+#pragma region Threshold and save image to file
+    // A single threshold is applied in place
+    if (nthresholds > 1)
+        destination = vc_image_new(grad->width, grad->height, 1, grad->levels);
     else
+        destination = grad;
+
+    if (!destination)
     {
-        fprintf(stderr, ">> Error! Wrong edge method. Please input \"sobel\" or \"prewitt\" on the @edge_detection specification.\n./program @inputname @outputname @edge_detection @threshold[0.001, 1.00]\nPress any key...");
+        fprintf(stderr, "Memory alloc error!\nPress any key...");
         getchar();
         exit(1);
     }
-#pragma endregion
 
-#pragma region Save image to file
-    // Save destination image
-    if (vc_write_image(argv[2], destination) == 1)
-        puts(">> Image saved.");
-    else{
-        fprintf(stderr, ">> Error! Image not saved!\nPress any key...");
-        getchar();
-        exit(1);
+    for (i = 0; i < nthresholds; i++)
+    {
+        if (destination != grad)
+            memcpy(destination->data, grad->data, (size_t)grad->bytesperline * grad->height);
+
+        vc_gray_binarize(destination, 1, destination->height, edge_threshold(hist, grad->levels, (long long)grad->width * grad->height, thresholds[i], &options));
+
+        if (nthresholds > 1)
+            threshold_outname(argv[2], thresholdnames[i], outname);
+        else
+            snprintf(outname, FILENAMELEN, "%s", argv[2]);
+
+        // Save destination image
+        if (vc_write_image(outname, destination) == 1)
+            printf(">> Image saved (threshold %s).\n", thresholdnames[i]);
+        else
+        {
+            fprintf(stderr, ">> Error! Image not saved!\nPress any key...");
+            getchar();
+            exit(1);
+        }
     }
 #pragma endregion
 
@@ -119,9 +887,10 @@ int main(int argc, char const *argv[])
     /** 
      * Free memory and exit.
      */
-    vc_image_free(origin);
-    vc_image_free(aux);
-    vc_image_free(destination);
+    if (destination != grad)
+        vc_image_free(destination);
+    vc_image_free(grad);
+    free(hist);
 #pragma endregion
 
     printf("Press any key to exit...");